@@ -4,6 +4,8 @@
 #include <iostream>
 #include <cmath>
 
+#include "../trace.hpp"
+
 namespace yap = boost::yap;
 
 enum Targ {host, device};
@@ -96,14 +98,14 @@ using namespace boost::yap::literals;
 
 void TestBasic() {
     printf("\ntest placeholder\n");
-    PrintTypeName(1_p);
+    printf("%s\n", TypeName<decltype(1_p)>());
 
     auto n1 = Number();
     auto n2 = Number(1.0);
     printf("\ntest expr\n");
     // auto expr = Add<host>(term<Number>{n1}, term<Number>{n2}, std::move(config));
     auto expr = 1_p + n1;
-    PrintTypeName(expr);
+    printf("%s\n", TypeName<decltype(expr)>());
     yap::print(std::cout, expr);
 
     printf("\ntest evaluate\n");
@@ -112,7 +114,7 @@ void TestBasic() {
 
     printf("\ntest expr2\n");
     auto expr2 = yap::make_terminal<yap::minimal_expr>(n1);
-    PrintTypeName(expr2);
+    printf("%s\n", TypeName<decltype(expr2)>());
     yap::print(std::cout, expr2);
 }
 
@@ -147,18 +149,17 @@ struct NumberExprT {
 template <typename T>
 using term = boost::yap::terminal<boost::yap::expression, T>;
 
+template <typename Trace = DefaultTrace>
 struct Transformer {
     term<Number> operator() (const term<Number> &n) {
-        printf("Terminal1 matched\n");
+        Trace::Record("Terminal1 matched");
         double value = yap::value(n).x;
-        yap::value(n).Println();
         return term<Number>{Number(value + 10.0)};
     }
 
     term<Number> operator() (const term<Number &> &n) {
-        printf("Terminal2 matched\n");
+        Trace::Record("Terminal2 matched");
         double value = yap::value(n).x;
-        yap::value(n).Println();
         return term<Number>{Number(value + 10.0)};
     }
 
@@ -166,9 +167,7 @@ struct Transformer {
     auto operator() (yap::expression<
                         yap::expr_kind::plus,
                         boost::hana::tuple<Expr1, Expr2> > const &plus_expr) {
-        printf("plus_expr matched\n");
-        yap::print(std::cout, yap::left(plus_expr));
-        yap::print(std::cout, yap::right(plus_expr));
+        Trace::Record("plus_expr matched", TypeName<decltype(plus_expr)>());
         return yap::transform(yap::left(plus_expr), *this) +
                yap::transform(yap::right(plus_expr), *this);
     }
@@ -181,8 +180,7 @@ struct Transformer {
 
     template <typename Expr>
     auto operator() (Expr const &expr) {
-        printf("Should not match this\n");
-        yap::print(std::cout, expr);
+        Trace::Record("Should not match this", TypeName<Expr>());
         return expr;
     }
 };
@@ -216,7 +214,8 @@ void TestNumberExpr3() {
     // Transfoermer::operand(term<Number> &&n)
     auto expr1 = term<Number>(n1) + n2;
     yap::print(std::cout, expr1);
-    auto expr2 = yap::transform(expr1, Transformer{});
+    auto expr2 = yap::transform(expr1, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
     auto r1 = yap::evaluate(expr2);
     r1.Println();
 }
@@ -5,6 +5,8 @@
 
 #include <iostream>
 
+#include "../trace.hpp"
+
 namespace yap = boost::yap;
 namespace hana = boost::hana;
 
@@ -18,20 +20,20 @@ auto const _2 = yap::make_terminal(at_placeholder<2>{});
 auto const _3 = yap::make_terminal(at_placeholder<3>{});
 auto const _4 = yap::make_terminal(at_placeholder<4>{});
 
-template <typename ExprMap>
+template <typename ExprMap, typename Trace = DefaultTrace>
 struct placeholder_transform {
     template<long long I>
     auto operator()(
         boost::yap::expr_tag<boost::yap::expr_kind::terminal>,
         at_placeholder<I> i)
     {   
-        printf("placeholder<%d> matched\n", I);
+        Trace::Record("placeholder matched", TypeName<at_placeholder<I>>());
     }   
 
     ExprMap map_;
 };
 
-template <typename ExprMap>
+template <typename ExprMap, typename Trace = DefaultTrace>
 struct xform {
     ExprMap map_;
 
@@ -39,14 +41,12 @@ struct xform {
 
     template <typename Expr1, typename Expr2>
     decltype(auto) constexpr operator()(yap::expr_tag<yap::expr_kind::assign>, Expr1 &&lhs, Expr2 &&rhs) const {
-        std::cout << "xform: assign matched\n";
-        yap::print(std::cout, yap::as_expr(std::forward<Expr1>(lhs)));
+        Trace::Record("xform: assign matched", TypeName<Expr1>());
     }
 
     template <long long I, typename Expr2>
     decltype(auto) constexpr operator()(yap::expr_tag<yap::expr_kind::assign>, at_placeholder<I> const &lhs, Expr2 &&rhs) const {
-        std::cout << "xform: assign placeholder matched\n";
-        yap::print(std::cout, yap::as_expr(std::forward<Expr2>(rhs)));
+        Trace::Record("xform: assign placeholder matched", TypeName<Expr2>());
     }
 };
 
@@ -58,5 +58,6 @@ int main() {
         auto expr = (_0 = call_foo());
         yap::print(std::cout, expr);
         yap::transform(expr, xform{hana::make_map()});
+        DefaultTrace::Dump(std::cout);
     }
 }
@@ -6,6 +6,8 @@
 
 #include <iostream>
 
+#include "../trace.hpp"
+
 namespace yap = boost::yap;
 namespace hana = boost::hana;
 
@@ -19,20 +21,20 @@ auto const _2 = yap::make_terminal(at_placeholder<2>{});
 auto const _3 = yap::make_terminal(at_placeholder<3>{});
 auto const _4 = yap::make_terminal(at_placeholder<4>{});
 
-template <typename ExprMap>
+template <typename ExprMap, typename Trace = DefaultTrace>
 struct placeholder_transform {
     template<long long I>
     auto operator()(
         boost::yap::expr_tag<boost::yap::expr_kind::terminal>,
         at_placeholder<I> i)
     {   
-        printf("placeholder<%d> matched\n", I);
+        Trace::Record("placeholder matched", TypeName<at_placeholder<I>>());
     }   
 
     ExprMap map_;
 };
 
-template <typename ExprMap>
+template <typename ExprMap, typename Trace = DefaultTrace>
 struct xform {
     ExprMap map_;
 
@@ -40,14 +42,12 @@ struct xform {
 
     template <typename Expr1, typename Expr2>
     decltype(auto) constexpr operator()(yap::expr_tag<yap::expr_kind::assign>, Expr1 &&lhs, Expr2 &&rhs) const {
-        std::cout << "xform: assign matched\n";
-        yap::print(std::cout, yap::as_expr(std::forward<Expr1>(lhs)));
+        Trace::Record("xform: assign matched", TypeName<Expr1>());
     }
 
     template <long long I, typename Expr2>
     decltype(auto) constexpr operator()(yap::expr_tag<yap::expr_kind::assign>, at_placeholder<I> const &lhs, Expr2 &&rhs) const {
-        std::cout << "xform: assign placeholder matched\n";
-        yap::print(std::cout, yap::as_expr(std::forward<Expr2>(rhs)));
+        Trace::Record("xform: assign placeholder matched", TypeName<Expr2>());
     }
 };
 
@@ -86,7 +86,7 @@ auto PrintIRList(IRList &&irList) {
     );
 }
 
-template <typename Sequence>
+template <typename Sequence, typename Trace = DefaultTrace>
 struct GenIR {
     Sequence mIRList;
 
@@ -94,20 +94,20 @@ struct GenIR {
 
     template <typename Callable, typename ...Args>
     auto operator() (yap::expr_tag<yap::expr_kind::call>, Callable &&callable, Args &&...args) {
-        printf("GenIR: call matched\n");
+        Trace::Record("GenIR: call matched");
         auto assign = yap::make_expression<yap::expr_kind::assign>(
             yap::make_terminal(GenTemp()),
             yap::make_expression<yap::expr_kind::call>(yap::as_expr(callable), yap::as_expr(args)...)
         );
-        printf("assign:\n"); yap::print(std::cout, assign);
+        Trace::Record("assign:", TypeName<decltype(assign)>());
         return hana::append(mIRList, hana::make_pair(assign, yap::left(assign)));
     }
 
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::plus>, Expr1 &&lhs, Expr2 &&rhs) {
-        printf("GenIR: plus matched\n");
-        auto lhsList = yap::transform(yap::as_expr(lhs), GenIR<decltype(mIRList)>(mIRList));
-        auto rhsList = yap::transform(yap::as_expr(rhs), GenIR<decltype(mIRList)>(mIRList));
+        Trace::Record("GenIR: plus matched");
+        auto lhsList = yap::transform(yap::as_expr(lhs), GenIR<decltype(mIRList), Trace>(mIRList));
+        auto rhsList = yap::transform(yap::as_expr(rhs), GenIR<decltype(mIRList), Trace>(mIRList));
         // printf("lhsList:\n"); PrintIRList(lhsList);
         // printf("rhsList:\n"); PrintIRList(rhsList);
         // yap::print(std::cout, hana::second(hana::back(lhsList)));
@@ -141,6 +141,7 @@ int main() {
         // auto irList = yap::transform(expr, GenIR{hana::make_tuple(), hana::make_tuple()});
         // PrintIRList(hana::first(irList));
         auto irList = yap::transform(expr, GenIR{hana::make_tuple()});
+        DefaultTrace::Dump(std::cout);
         printf("After transform:\n");
         PrintIRList(irList);
     }
@@ -6,6 +6,8 @@
 
 #include <iostream>
 
+#include "../trace.hpp"
+
 namespace yap = boost::yap;
 namespace hana = boost::hana;
 
@@ -19,20 +21,20 @@ auto const _2 = yap::make_terminal(at_placeholder<2>{});
 auto const _3 = yap::make_terminal(at_placeholder<3>{});
 auto const _4 = yap::make_terminal(at_placeholder<4>{});
 
-template <typename ExprMap>
+template <typename ExprMap, typename Trace = DefaultTrace>
 struct placeholder_transform {
     template<long long I>
     auto operator()(
         boost::yap::expr_tag<boost::yap::expr_kind::terminal>,
         at_placeholder<I> i)
     {   
-        printf("placeholder<%d> matched\n", I);
+        Trace::Record("placeholder matched", TypeName<at_placeholder<I>>());
     }   
 
     ExprMap map_;
 };
 
-template <typename ExprMap>
+template <typename ExprMap, typename Trace = DefaultTrace>
 struct xform {
     ExprMap map_;
 
@@ -40,14 +42,12 @@ struct xform {
 
     template <typename Expr1, typename Expr2>
     decltype(auto) constexpr operator()(yap::expr_tag<yap::expr_kind::assign>, Expr1 &&lhs, Expr2 &&rhs) const {
-        std::cout << "xform: assign matched\n";
-        yap::print(std::cout, yap::as_expr(std::forward<Expr1>(lhs)));
+        Trace::Record("xform: assign matched", TypeName<Expr1>());
     }
 
     template <long long I, typename Expr2>
     decltype(auto) constexpr operator()(yap::expr_tag<yap::expr_kind::assign>, at_placeholder<I> const &lhs, Expr2 &&rhs) const {
-        std::cout << "xform: assign placeholder matched\n";
-        yap::print(std::cout, yap::as_expr(std::forward<Expr2>(rhs)));
+        Trace::Record("xform: assign placeholder matched", TypeName<Expr2>());
     }
 };
 
@@ -82,7 +82,7 @@ auto PrintIRList(IRList &&irList) {
 }
 
 // This pass generates a sequence of IR
-template <typename Sequence1, typename Sequence2>
+template <typename Sequence1, typename Sequence2, typename Trace = DefaultTrace>
 struct GenIR {
     // Sequence1 is the generated IR list
     Sequence1 mIRList;
@@ -93,7 +93,7 @@ struct GenIR {
 
     template <typename Callable, typename ...Args>
     auto operator() (yap::expr_tag<yap::expr_kind::call>, Callable &&callable, Args &&...args) {
-        printf("GenIR: call matched\n");
+        Trace::Record("GenIR: call matched");
         if constexpr (sizeof...(Args) != 0) {
             auto argTuple = hana::make_tuple(args...);
         }
@@ -104,22 +104,19 @@ struct GenIR {
         auto assign = yap::make_expression<yap::expr_kind::assign>(destExpr,
             yap::make_expression<yap::expr_kind::call>(yap::as_expr(callable), yap::as_expr(args)...)
         );
-        printf("assign:\n");
-        yap::print(std::cout, assign);
-        PrintIRList(hana::append(mIRList, std::move(assign)));
+        Trace::Record("assign:", TypeName<decltype(assign)>());
         return hana::make_pair(hana::append(mIRList, std::move(assign)), hana::append(mInfoList, destExpr));
     }
 
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::plus>, Expr1 &&lhs, Expr2 &&rhs) {
-        printf("GenIR: plus_expr matched\n");
+        Trace::Record("GenIR: plus_expr matched");
         using Seq1 = decltype(mIRList);
         using Seq2 = decltype(mInfoList);
-        auto lhsPair = yap::transform(yap::as_expr(lhs), GenIR<Seq1, Seq2>{mIRList, mInfoList});
-        // PrintTypeName(hana::first(lhsPair));
-        PrintIRList(hana::first(lhsPair));
-        auto rhsPair = yap::transform(yap::as_expr(rhs), GenIR<Seq1, Seq2>{mIRList, mInfoList});
-        PrintIRList(hana::first(rhsPair));
+        auto lhsPair = yap::transform(yap::as_expr(lhs), GenIR<Seq1, Seq2, Trace>{mIRList, mInfoList});
+        Trace::Record("lhs IR list:", TypeName<decltype(hana::first(lhsPair))>());
+        auto rhsPair = yap::transform(yap::as_expr(rhs), GenIR<Seq1, Seq2, Trace>{mIRList, mInfoList});
+        Trace::Record("rhs IR list:", TypeName<decltype(hana::first(rhsPair))>());
         auto expr = yap::make_expression<yap::expr_kind::plus>(yap::as_expr(lhs), yap::as_expr(rhs));
         return hana::make_pair(
             hana::concat(hana::concat(mIRList, hana::first(lhsPair)), hana::first(rhsPair)),
@@ -137,6 +134,7 @@ int main() {
         yap::print(std::cout, expr);
         // yap::transform(expr, xform{hana::make_map()});
         auto irList = yap::transform(expr, GenIR{hana::make_tuple(), hana::make_tuple()});
+        DefaultTrace::Dump(std::cout);
         PrintIRList(hana::first(irList));
     }
 }
@@ -5,20 +5,18 @@
 #include <cassert>
 
 #include <iostream>
+#include <map>
+#include <vector>
+
+#include "../accumulate.hpp"
+#include "../simplify.hpp"
+#include "../temps.hpp"
+#include "../trace.hpp"
 
 namespace yap = boost::yap;
 namespace hana = boost::hana;
 using namespace hana::literals;
 
-// A placeholder for temporary variables
-template <long long I>
-struct temp_placeholder : boost::hana::llong<I> {
-    friend std::ostream& operator<< (std::ostream& os, const temp_placeholder<I> &p) {
-        os << "temp" << I;
-        return os;
-    }
-};
-
 auto const _0 = yap::make_terminal(temp_placeholder<0>{});
 auto const _1 = yap::make_terminal(temp_placeholder<1>{});
 auto const _2 = yap::make_terminal(temp_placeholder<2>{});
@@ -48,118 +46,124 @@ constexpr auto MakeTensor(int id) {
     return Tensor{id};
 }
 
-template <typename Sequence, typename Stack, long long I = 1>
+// The pieces LowerToIRs() (see accumulate.hpp) lowers an expression to: IRs
+// _temp = lhs op rhs and _temp = call, whose operands are terminals.
 struct GenIR {
-    Sequence mIRList;
-    Stack mStack;
-    static const long long placeholder_index = I;
-
-    constexpr GenIR(const Sequence &seq, const Stack &stk) : mIRList(seq), mStack(stk) {
-        // printf("GenIR constructor:\n");
-        // printf("mIRList: "); hana::for_each(mIRList, [](const auto &ir) {yap::print(std::cout, ir);});
-        // printf("mStack: "); hana::for_each(mStack, [](const auto &expr) {yap::print(std::cout, expr);});
+    template <typename T>
+    auto Operand(T &&t) {
+        return yap::make_terminal(t);
     }
 
-    template <typename T>
-    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&t) {
-        // printf("GenIR: terminal matched\n");
-        // Push result onto stack
-        auto stack = hana::append(mStack, std::move(yap::make_terminal(t)));
-        return GenIR<decltype(mIRList), decltype(stack), I>{mIRList, stack};
+    template <long long I>
+    auto Temp() {
+        return yap::make_terminal(temp_placeholder<I>{});
     }
 
-    template <yap::expr_kind Kind, typename Expr1, typename Expr2>
-    auto operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) {
-        // printf("GenIR: binary op matched\n");
-        auto genLhs = yap::transform(yap::as_expr(lhs), GenIR<decltype(mIRList), decltype(mStack), I>(mIRList, mStack));
-        // printf("genLhs:\n"); PrintIRList(genLhs.mIRList);
-        auto genRhs = yap::transform(yap::as_expr(rhs), genLhs);
-        // printf("genRhs:\n"); PrintIRList(genRhs.mIRList);
-
-        auto constexpr index = decltype(genRhs)::placeholder_index;
-        auto temp = yap::make_terminal(temp_placeholder<index>{});
-        auto assign = yap::make_expression<yap::expr_kind::assign>(std::move(temp),
-            yap::make_expression<Kind>(
-                std::move(hana::back(genLhs.mStack)),  // lhs's result
-                std::move(hana::back(genRhs.mStack))   // rhs's result
-            )
-        );
-        // printf("append:\n"); yap::print(std::cout, assign);
-        auto newIRList = hana::append(genRhs.mIRList, std::move(assign));
-        // Skip poping operands from mStack
-        // Push result onto stack
-        auto newStack = hana::append(mStack, std::move(temp));
-
-        return GenIR<decltype(newIRList), decltype(newStack), index + 1>(newIRList, newStack);
+    template <long long I, yap::expr_kind Kind, typename Expr1, typename Expr2>
+    auto Binary(Expr1 &&lhs, Expr2 &&rhs) {
+        return yap::make_expression<yap::expr_kind::assign>(
+            Temp<I>(), yap::make_expression<Kind>(std::move(lhs), std::move(rhs)));
     }
 
-    template <typename Callable, typename ...Args>
-    auto operator() (yap::expr_tag<yap::expr_kind::call>, Callable &&callable, Args &&...args) {
-        // printf("GenIR: call matched\n");
-        auto assign = yap::make_expression<yap::expr_kind::assign>(
-            yap::make_terminal(temp_placeholder<I>{}),
-            yap::make_expression<yap::expr_kind::call>(yap::as_expr(callable), yap::as_expr(args)...)
-        );
-        // printf("assign:\n"); yap::print(std::cout, assign);
-        auto newIRList = hana::append(mIRList, std::move(assign));
-        auto newStack = hana::append(mStack, std::move(yap::make_terminal(temp_placeholder<I>{})));
-        return GenIR<decltype(newIRList), decltype(newStack), I + 1>{newIRList, newStack};
+    template <long long I, typename Callable, typename ...Args>
+    auto Call(Callable &&callable, Args &&...args) {
+        return yap::make_expression<yap::expr_kind::assign>(
+            Temp<I>(), yap::make_expression<yap::expr_kind::call>(yap::as_expr(callable), std::move(args)...));
     }
+};
 
+template <typename IRList>
+struct LoweredIR {
+    IRList mIRList;
 };
 
-template <typename Map>
+// Lowers expr.  mIRList of the result is a hana::tuple of the IRs.
+template <typename Expr>
+auto LowerIR(Expr &&expr) {
+    GenIR gen;
+    auto irList = LowerToIRs(gen, yap::as_expr(expr));
+    return LoweredIR<decltype(irList)>{std::move(irList)};
+}
+
+// Acquires a tensor from the pool for the temp an IR defines.
+template <typename Trace = DefaultTrace>
 struct AllocBufferXform {
-    const Map &mMap; // A map from TempVar to expression
+    std::map<long long, Tensor> &mTensors; // Temp => its tensor
+    BufferPool<Tensor> &mPool;
+
+    AllocBufferXform(std::map<long long, Tensor> &tensors, BufferPool<Tensor> &pool) : mTensors(tensors), mPool(pool) {}
 
-    constexpr AllocBufferXform(const Map &map) : mMap(map) {}
+    // Every temp holds a single value
+    Tensor AcquireTensor(long long temp) {
+        return mPool.Acquire(temp, 1, [](int id, std::size_t) { return MakeTensor(id); });
+    }
 
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, Expr1 &&lhs, Expr2 &&rhs) {
-        printf("AllocBufferXform: common assign matched\n");
+        Trace::Record("AllocBufferXform: common assign matched");
         assert(false && "Should not reach here");
     }
 
     template <typename Expr2, long long I>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp, Expr2 &&rhs) const {
-        printf("AllocBufferXform: assign to temp matched\n");
+        Trace::Record("AllocBufferXform: assign to temp matched");
         assert(false && "Should not reach here");
     }
 
     template <long long I, yap::expr_kind Binary, typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp,
                      yap::expression<Binary, hana::tuple<Expr1, Expr2>> const &binaryExpr) {
-        printf("AllocBufferXform: assign _temp = lhs op rhs matched\n");
+        Trace::Record("AllocBufferXform: assign _temp = lhs op rhs matched");
         auto lhs = yap::left(binaryExpr);
         auto rhs = yap::right(binaryExpr);
         static_assert(decltype(lhs)::kind == yap::expr_kind::terminal);
         static_assert(decltype(rhs)::kind == yap::expr_kind::terminal);
         // TODO: use rhs's info to infer information for tensor
-        auto tensor = MakeTensor(I);
-        auto expr = yap::make_terminal(std::move(tensor));
-        return hana::insert(mMap, hana::make_pair(hana::llong_c<I>, expr));
+        auto tensor = AcquireTensor(I);
+        mTensors.emplace(I, std::move(tensor));
     }
 
     template <long long I, typename Fn, typename ...Args>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp,
                      yap::expression<yap::expr_kind::call, hana::tuple<Fn, Args...>> const &callExpr) {
-        printf("AllocBufferXform: assign _temp = call matched\n");
-        auto tensor = MakeTensor(I);
-        auto expr = yap::make_terminal(std::move(tensor));
-        return hana::insert(mMap, hana::make_pair(hana::llong_c<I>, expr));
+        Trace::Record("AllocBufferXform: assign _temp = call matched");
+        auto tensor = AcquireTensor(I);
+        mTensors.emplace(I, std::move(tensor));
     }
 };
 
+// The temp an IR _temp = ... defines, as hana::llong_c<I>.
+template <typename IR>
+constexpr auto TempOf(IR const &ir) {
+    return hana::llong_c<std::decay_t<decltype(yap::value(yap::left(ir)))>::value>;
+}
+
 // Given a sequence of IRList, assign a tensor for each temp_placeholder and returns a map
-// recording them.
+// recording them.  Temps share buffers from pool according to their liveness.
 template <typename Sequence>
-auto AllocBuffer(const Sequence &irList) {
-    // Given a map and an expression, returns a new map containing placeholder => tensor
-    auto fn = [](auto &&map, auto &&ir) -> decltype(auto) {
-        return yap::transform(ir, AllocBufferXform{map});
-    };
+auto AllocBuffer(const Sequence &irList, BufferPool<Tensor> &pool) {
+    Liveness live = ComputeLiveness(irList);
+    std::map<long long, Tensor> tensors;
+    // The state of the fold is the index of the IR
+    hana::fold(irList, std::size_t(0), [&](std::size_t k, auto const &ir) {
+        yap::transform(ir, AllocBufferXform<>{tensors, pool});
+        // Operands are released only after the IR's own temp is allocated, so
+        // an IR never writes a buffer it reads.
+        for (auto temp : live.mDying[k])
+            pool.Release(temp);
+        return k + 1;
+    });
+    printf("AllocBuffer: %zu temps in %zu buffers\n", pool.mTemps, pool.mBuffers.size());
+    // The map is built once, from the temps of all the IRs
+    return hana::unpack(irList, [&tensors](auto const &...irs) {
+        return hana::make_map(hana::make_pair(TempOf(irs), yap::make_terminal(std::move(tensors.at(TempOf(irs)))))...);
+    });
+}
 
-    return hana::fold(irList, hana::make_map(), fn);
+template <typename Sequence>
+auto AllocBuffer(const Sequence &irList) {
+    BufferPool<Tensor> pool;
+    return AllocBuffer(irList, pool);
 }
 
 template <typename ExprMap>
@@ -194,7 +198,7 @@ using result_t = std::result_of_t<Fn()>;
 template <typename Fn>
 auto print_func_result_type(Fn &&fn) {
     using t = std::result_of_t<Fn()>;
-    PrintTypeName<t>();
+    std::cout << TypeName<t>() << std::endl;
 }
 
 int main() {
@@ -205,13 +209,30 @@ int main() {
         auto call_foo = yap::make_terminal(foo);
         auto expr = yap::make_terminal(a) * 2 + call_foo() + yap::make_terminal(b) * 3;
         yap::print(std::cout, expr);
-        auto gen = yap::transform(expr, GenIR{hana::make_tuple(), hana::make_tuple()});
+        auto gen = LowerIR(expr);
         printf("After transform:\n");
         PrintIRList(gen.mIRList);
 
         auto &&map = AllocBuffer(gen.mIRList);
+        DefaultTrace::Dump(std::cout);
         auto irList2 = SubstituteTemps(gen.mIRList, map);
         printf("After AllocBuffer and SubstituteTemps:\n");
         PrintIRList(irList2);
     }
+    {
+        // Constant subtrees, identities and multiplications by powers of two
+        // are simplified before GenIR
+        auto expr = (yap::make_terminal(a) * 1_c + yap::make_terminal(b) * 0_c) * 8_c +
+                    2_c * (yap::make_terminal(b) * (3 + yap::make_terminal(4)));
+        yap::print(std::cout, expr);
+        auto gen = LowerIR(expr);
+        auto simplified = Simplify(expr);
+        printf("After Simplify:\n");
+        yap::print(std::cout, simplified);
+        auto gen2 = LowerIR(simplified);
+        PrintIRList(gen2.mIRList);
+        printf("IR list length: %zu before Simplify, %zu after\n",
+               std::size_t(hana::length(gen.mIRList)), std::size_t(hana::length(gen2.mIRList)));
+        assert(yap::evaluate(simplified) == yap::evaluate(expr));
+    }
 }
@@ -4,21 +4,23 @@
 #include <boost/yap/print.hpp>
 #include <cassert>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "../accumulate.hpp"
+#include "../simplify.hpp"
+#include "../temps.hpp"
+#include "../trace.hpp"
 
 namespace yap = boost::yap;
 namespace hana = boost::hana;
 using namespace hana::literals;
 
-// A placeholder for temporary variables
-template <long long I>
-struct temp_placeholder : boost::hana::llong<I> {
-    friend std::ostream& operator<< (std::ostream& os, const temp_placeholder<I> &p) {
-        os << "temp" << I;
-        return os;
-    }
-};
-
 auto const _0 = yap::make_terminal(temp_placeholder<0>{});
 auto const _1 = yap::make_terminal(temp_placeholder<1>{});
 auto const _2 = yap::make_terminal(temp_placeholder<2>{});
@@ -35,147 +37,208 @@ auto PrintIRList(IRList &&irList) {
     );
 }
 
-long memory[100] = {0};
+using Element = float;
+using Shape = std::vector<std::size_t>;
+
+// Tensor buffers are aligned for the widest vector loads/stores.
+constexpr std::size_t kAlignment = 64;
+
+std::size_t NumElements(const Shape &shape) {
+    std::size_t n = 1;
+    for (auto d : shape)
+        n *= d;
+    return n;
+}
+
+std::ostream& operator<< (std::ostream &os, const Shape &shape) {
+    os << "[";
+    for (std::size_t i = 0; i < shape.size(); ++i)
+        os << (i ? "x" : "") << shape[i];
+    return os << "]";
+}
+
+// A tensor owns an aligned buffer holding NumElements(shape) elements.  Copies
+// share the buffer, so the terminals that GenIR, AllocBuffer and
+// SubstituteTemps copy around all refer to the same storage.  A tensor with an
+// empty shape holds a single element and is broadcast by the kernels.
 struct Tensor {
     int id;
+    Shape shape;
+    std::shared_ptr<Element> buffer;
+
+    Tensor(int id, const Shape &shape) : id(id), shape(shape) {
+        std::size_t bytes = (NumElements(shape) * sizeof(Element) + kAlignment - 1) / kAlignment * kAlignment;
+        // A shape with a zero dimension has no elements and gets no buffer.
+        if (bytes != 0)
+            buffer.reset(static_cast<Element *>(std::aligned_alloc(kAlignment, bytes)), std::free);
+    }
+
+    std::size_t size() const { return NumElements(shape); }
+    Element *data() const { return buffer.get(); }
 
-    constexpr Tensor(int id) : id(id) {}
+    void Fill(Element value) const { std::fill(data(), data() + size(), value); }
 
     friend std::ostream& operator<< (std::ostream &os, const Tensor &t) {
-        os << "tensor" << t.id << "{" << memory[t.id] << "}";
+        os << "tensor" << t.id << t.shape << "{";
+        if (t.size() > 0)
+            os << t.data()[0];
+        if (t.size() > 1)
+            os << ", ..., " << t.data()[t.size() - 1];
+        os << "}";
         return os;
     }
-
-    long operator+ (const Tensor &other) {
-        return memory[this->id] + memory[other.id];
-    }
-    long operator+ (const long &other) {
-        return memory[this->id] + other;
-    }
-    long operator* (const Tensor &other) {
-        return memory[this->id] * memory[other.id];
-    }
-    long operator* (const long &other) {
-        return memory[this->id] * other;
-    }
 };
 
-constexpr auto MakeTensor(int id) {
-    return Tensor{id};
+auto MakeTensor(int id, const Shape &shape) {
+    return Tensor{id, shape};
 }
 
-template <typename Sequence, typename Stack, long long I = 1>
+// The pieces LowerToIRs() (see accumulate.hpp) lowers an expression to: IRs
+// _temp = lhs op rhs and _temp = call, whose operands are terminals.
 struct GenIR {
-    Sequence mIRList;
-    Stack mStack;
-    static const long long placeholder_index = I;
-
-    constexpr GenIR(const Sequence &seq, const Stack &stk) : mIRList(seq), mStack(stk) {
-        // printf("GenIR constructor:\n");
-        // printf("mIRList: "); hana::for_each(mIRList, [](const auto &ir) {yap::print(std::cout, ir);});
-        // printf("mStack: "); hana::for_each(mStack, [](const auto &expr) {yap::print(std::cout, expr);});
+    template <typename T>
+    auto Operand(T &&t) {
+        return yap::make_terminal(t);
     }
 
-    template <typename T>
-    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&t) {
-        // printf("GenIR: terminal matched\n");
-        // Push result onto stack
-        auto stack = hana::append(mStack, std::move(yap::make_terminal(t)));
-        return GenIR<decltype(mIRList), decltype(stack), I>{mIRList, stack};
+    template <long long I>
+    auto Temp() {
+        return yap::make_terminal(temp_placeholder<I>{});
     }
 
-    template <yap::expr_kind Kind, typename Expr1, typename Expr2>
-    auto operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) {
-        // printf("GenIR: binary op matched\n");
-        auto genLhs = yap::transform(yap::as_expr(lhs), GenIR<decltype(mIRList), decltype(mStack), I>(mIRList, mStack));
-        // printf("genLhs:\n"); PrintIRList(genLhs.mIRList);
-        auto genRhs = yap::transform(yap::as_expr(rhs), genLhs);
-        // printf("genRhs:\n"); PrintIRList(genRhs.mIRList);
-
-        auto constexpr index = decltype(genRhs)::placeholder_index;
-        auto temp = yap::make_terminal(temp_placeholder<index>{});
-        auto assign = yap::make_expression<yap::expr_kind::assign>(std::move(temp),
-            yap::make_expression<Kind>(
-                std::move(hana::back(genLhs.mStack)),  // lhs's result
-                std::move(hana::back(genRhs.mStack))   // rhs's result
-            )
-        );
-        // printf("append:\n"); yap::print(std::cout, assign);
-        auto newIRList = hana::append(genRhs.mIRList, std::move(assign));
-        // Skip poping operands from mStack
-        // Push result onto stack
-        auto newStack = hana::append(mStack, std::move(temp));
-
-        return GenIR<decltype(newIRList), decltype(newStack), index + 1>(newIRList, newStack);
+    template <long long I, yap::expr_kind Kind, typename Expr1, typename Expr2>
+    auto Binary(Expr1 &&lhs, Expr2 &&rhs) {
+        return yap::make_expression<yap::expr_kind::assign>(
+            Temp<I>(), yap::make_expression<Kind>(std::move(lhs), std::move(rhs)));
     }
 
-    template <typename Callable, typename ...Args>
-    auto operator() (yap::expr_tag<yap::expr_kind::call>, Callable &&callable, Args &&...args) {
-        // printf("GenIR: call matched\n");
-        auto assign = yap::make_expression<yap::expr_kind::assign>(
-            yap::make_terminal(temp_placeholder<I>{}),
-            yap::make_expression<yap::expr_kind::call>(yap::as_expr(callable), yap::as_expr(args)...)
-        );
-        // printf("assign:\n"); yap::print(std::cout, assign);
-        auto newIRList = hana::append(mIRList, std::move(assign));
-        auto newStack = hana::append(mStack, std::move(yap::make_terminal(temp_placeholder<I>{})));
-        return GenIR<decltype(newIRList), decltype(newStack), I + 1>{newIRList, newStack};
+    template <long long I, typename Callable, typename ...Args>
+    auto Call(Callable &&callable, Args &&...args) {
+        return yap::make_expression<yap::expr_kind::assign>(
+            Temp<I>(), yap::make_expression<yap::expr_kind::call>(yap::as_expr(callable), std::move(args)...));
     }
+};
 
+template <typename IRList>
+struct LoweredIR {
+    IRList mIRList;
 };
 
-template <typename Map>
+// Lowers expr.  mIRList of the result is a hana::tuple of the IRs.
+template <typename Expr>
+auto LowerIR(Expr &&expr) {
+    GenIR gen;
+    auto irList = LowerToIRs(gen, yap::as_expr(expr));
+    return LoweredIR<decltype(irList)>{std::move(irList)};
+}
+
+// Acquires a tensor from the pool for the temp an IR defines.
+template <typename Trace = DefaultTrace>
 struct AllocBufferXform {
-    const Map &mMap; // A map from TempVar to expression
+    std::map<long long, Tensor> &mTensors; // Temp => its tensor
+    BufferPool<Tensor> &mPool;
+
+    AllocBufferXform(std::map<long long, Tensor> &tensors, BufferPool<Tensor> &pool) : mTensors(tensors), mPool(pool) {}
+
+    // A tensor of the given shape for temp
+    Tensor AcquireTensor(long long temp, const Shape &shape) {
+        Tensor tensor = mPool.Acquire(temp, NumElements(shape), [&shape](int id, std::size_t) {
+            return MakeTensor(id, shape);
+        });
+        tensor.shape = shape;
+        return tensor;
+    }
 
-    constexpr AllocBufferXform(const Map &map) : mMap(map) {}
+    // Shapes of the operands an IR reads: a tensor has its own shape, a temp has
+    // the shape of the tensor already allocated for it, and a scalar is rank 0.
+    Shape ShapeOf(const Tensor &t) const { return t.shape; }
+
+    template <long long J>
+    Shape ShapeOf(const temp_placeholder<J> &) const {
+        auto it = mTensors.find(J);
+        assert(it != mTensors.end() && "temp used before it is defined");
+        return it->second.shape;
+    }
+
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic<std::decay_t<T>>::value>>
+    Shape ShapeOf(const T &) const { return {}; }
+
+    // Elementwise ops broadcast rank 0 operands; otherwise the shapes must match.
+    Shape BroadcastShape(const Shape &lhs, const Shape &rhs) const {
+        if (lhs.empty())
+            return rhs;
+        assert((rhs.empty() || rhs == lhs) && "Tensor shapes of an elementwise op must match");
+        return lhs;
+    }
 
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, Expr1 &&lhs, Expr2 &&rhs) {
-        printf("AllocBufferXform: common assign matched\n");
+        Trace::Record("AllocBufferXform: common assign matched");
         assert(false && "Should not reach here");
     }
 
     template <typename Expr2, long long I>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp, Expr2 &&rhs) const {
-        printf("AllocBufferXform: assign to temp matched\n");
+        Trace::Record("AllocBufferXform: assign to temp matched");
         assert(false && "Should not reach here");
     }
 
     template <long long I, yap::expr_kind Binary, typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp,
                      yap::expression<Binary, hana::tuple<Expr1, Expr2>> const &binaryExpr) {
-        printf("AllocBufferXform: assign _temp = lhs op rhs matched\n");
+        Trace::Record("AllocBufferXform: assign _temp = lhs op rhs matched");
         auto lhs = yap::left(binaryExpr);
         auto rhs = yap::right(binaryExpr);
         static_assert(decltype(lhs)::kind == yap::expr_kind::terminal);
         static_assert(decltype(rhs)::kind == yap::expr_kind::terminal);
-        // TODO: use rhs's info to infer information for tensor
-        auto tensor = MakeTensor(I);
-        auto expr = yap::make_terminal(std::move(tensor));
-        return hana::insert(mMap, hana::make_pair(hana::llong_c<I>, expr));
+        auto shape = BroadcastShape(ShapeOf(yap::value(lhs)), ShapeOf(yap::value(rhs)));
+        auto tensor = AcquireTensor(I, shape);
+        mTensors.emplace(I, std::move(tensor));
     }
 
     template <long long I, typename Fn, typename ...Args>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp,
                      yap::expression<yap::expr_kind::call, hana::tuple<Fn, Args...>> const &callExpr) {
-        printf("AllocBufferXform: assign _temp = call matched\n");
-        auto tensor = MakeTensor(I);
-        auto expr = yap::make_terminal(std::move(tensor));
-        return hana::insert(mMap, hana::make_pair(hana::llong_c<I>, expr));
+        Trace::Record("AllocBufferXform: assign _temp = call matched");
+        // A call returns a scalar, held in a rank 0 tensor
+        auto tensor = AcquireTensor(I, Shape{});
+        mTensors.emplace(I, std::move(tensor));
     }
 };
 
+// The temp an IR _temp = ... defines, as hana::llong_c<I>.
+template <typename IR>
+constexpr auto TempOf(IR const &ir) {
+    return hana::llong_c<std::decay_t<decltype(yap::value(yap::left(ir)))>::value>;
+}
+
 // Given a sequence of IRList, assign a tensor for each temp_placeholder and returns a map
-// recording them.
+// recording them.  Temps share buffers from pool according to their liveness.
 template <typename Sequence>
-auto AllocBuffer(const Sequence &irList) {
-    // Given a map and an expression, returns a new map containing placeholder => tensor
-    auto fn = [](auto &&map, auto &&ir) -> decltype(auto) {
-        return yap::transform(ir, AllocBufferXform{map});
-    };
+auto AllocBuffer(const Sequence &irList, BufferPool<Tensor> &pool, bool verbose = true) {
+    Liveness live = ComputeLiveness(irList);
+    std::map<long long, Tensor> tensors;
+    // The state of the fold is the index of the IR
+    hana::fold(irList, std::size_t(0), [&](std::size_t k, auto const &ir) {
+        yap::transform(ir, AllocBufferXform<>{tensors, pool});
+        // Operands are released only after the IR's own temp is allocated, so
+        // an IR never writes a buffer it reads.
+        for (auto temp : live.mDying[k])
+            pool.Release(temp);
+        return k + 1;
+    });
+    if (verbose)
+        printf("AllocBuffer: %zu temps in %zu buffers\n", pool.mTemps, pool.mBuffers.size());
+    // The map is built once, from the temps of all the IRs
+    return hana::unpack(irList, [&tensors](auto const &...irs) {
+        return hana::make_map(hana::make_pair(TempOf(irs), yap::make_terminal(std::move(tensors.at(TempOf(irs)))))...);
+    });
+}
 
-    return hana::fold(irList, hana::make_map(), fn);
+template <typename Sequence>
+auto AllocBuffer(const Sequence &irList, bool verbose = true) {
+    BufferPool<Tensor> pool;
+    return AllocBuffer(irList, pool, verbose);
 }
 
 template <typename ExprMap>
@@ -200,29 +263,97 @@ auto SubstituteTemps(Sequence &&irList, Map &&map) {
     });
 }
 
+// An input of an elementwise kernel: either a whole tensor or a scalar that is
+// broadcast.  Rank 0 tensors (e.g. call results) are read as scalars.
+struct Operand {
+    const Element *data;
+    Element scalar;
+};
+
+Operand MakeOperand(const Tensor &t) {
+    if (t.shape.empty())
+        return Operand{nullptr, t.data()[0]};
+    return Operand{t.data(), 0};
+}
+
+template <typename T, typename = std::enable_if_t<std::is_arithmetic<std::decay_t<T>>::value>>
+Operand MakeOperand(const T &t) {
+    return Operand{nullptr, static_cast<Element>(t)};
+}
+
+// Computes out[i] = op(lhs[i], rhs[i]).  Each combination of tensor and scalar
+// operands gets its own loop so that every one of them is vectorized.  out may
+// be one of the inputs, but only at the index being written.
+template <typename Op>
+void Elementwise(const Tensor &out, Operand lhs, Operand rhs, Op op) {
+    auto *dst = static_cast<Element *>(__builtin_assume_aligned(out.data(), kAlignment));
+    std::size_t n = out.size();
+    if (lhs.data && rhs.data) {
+        auto *x = static_cast<const Element *>(__builtin_assume_aligned(lhs.data, kAlignment));
+        auto *y = static_cast<const Element *>(__builtin_assume_aligned(rhs.data, kAlignment));
+#pragma GCC ivdep
+        for (std::size_t i = 0; i < n; ++i)
+            dst[i] = op(x[i], y[i]);
+    } else if (lhs.data) {
+        auto *x = static_cast<const Element *>(__builtin_assume_aligned(lhs.data, kAlignment));
+        Element y = rhs.scalar;
+#pragma GCC ivdep
+        for (std::size_t i = 0; i < n; ++i)
+            dst[i] = op(x[i], y);
+    } else if (rhs.data) {
+        Element x = lhs.scalar;
+        auto *y = static_cast<const Element *>(__builtin_assume_aligned(rhs.data, kAlignment));
+#pragma GCC ivdep
+        for (std::size_t i = 0; i < n; ++i)
+            dst[i] = op(x, y[i]);
+    } else {
+        std::fill(dst, dst + n, op(lhs.scalar, rhs.scalar));
+    }
+}
+
+void TensorAdd(const Tensor &out, Operand lhs, Operand rhs) {
+    Elementwise(out, lhs, rhs, [](Element x, Element y) { return x + y; });
+}
+
+void TensorMul(const Tensor &out, Operand lhs, Operand rhs) {
+    Elementwise(out, lhs, rhs, [](Element x, Element y) { return x * y; });
+}
+
+template <typename Trace = DefaultTrace>
 struct CodeGenXform {
     template <yap::expr_kind BinaryOP, typename Expr1, typename Expr2>
     auto operator()(yap::expr_tag<boost::yap::expr_kind::assign>, Tensor const &lhs,
-                    yap::expression<BinaryOP, hana::tuple<Expr1, Expr2>> const &rhs) {   
-        printf("CodeGenXform: tensor = expr1 op expr2 matched\n");
+                    yap::expression<BinaryOP, hana::tuple<Expr1, Expr2>> const &rhs) {
+        Trace::Record("CodeGenXform: tensor = expr1 op expr2 matched");
+        auto x = MakeOperand(yap::value(yap::left(rhs)));
+        auto y = MakeOperand(yap::value(yap::right(rhs)));
         if constexpr (BinaryOP == yap::expr_kind::plus) {
-            // memory[lhs.id] = yap::evaluate(yap::left(rhs) + yap::right(rhs));
-            std::cout << "Executing TensorAdd`" << std::endl;
+            TensorAdd(lhs, x, y);
         }
         else if constexpr (BinaryOP == yap::expr_kind::multiplies) {
-            // memory[lhs.id] = yap::evaluate(yap::left(rhs) * yap::right(rhs));
-            std::cout << "Executing TensorMul" << std::endl;
+            TensorMul(lhs, x, y);
+        }
+        else {
+            static_assert(BinaryOP == yap::expr_kind::plus, "No kernel for this operator");
         }
-        // std::cout << lhs << std::endl;
-        // return memory[lhs.id];
+    }
+
+    template <typename Fn, typename ...Args>
+    auto operator()(yap::expr_tag<boost::yap::expr_kind::assign>, Tensor const &lhs,
+                    yap::expression<yap::expr_kind::call, hana::tuple<Fn, Args...>> const &callExpr) {
+        Trace::Record("CodeGenXform: tensor = call matched");
+        lhs.Fill(static_cast<Element>(yap::evaluate(callExpr)));
     }
 };
 
+// Executes the IR list in order and returns the tensor holding the result of
+// the last IR.
 template <typename Sequence>
 auto CodeGen(Sequence &&irList) {
     hana::for_each(irList, [](const auto &ir) {
-        yap::transform(ir, CodeGenXform{});
+        yap::transform(ir, CodeGenXform<>{});
     });
+    return yap::value(yap::left(hana::back(irList)));
 }
 
 int foo() { return 0; }
@@ -235,19 +366,78 @@ using result_t = std::result_of_t<Fn()>;
 template <typename Fn>
 auto print_func_result_type(Fn &&fn) {
     using t = std::result_of_t<Fn()>;
-    PrintTypeName<t>();
+    std::cout << TypeName<t>() << std::endl;
+}
+
+template <typename Fn>
+double TimeMs(int repeat, Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+        fn();
+        // Keep the compiler from merging the repetitions.
+        asm volatile("" ::: "memory");
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / repeat;
+}
+
+// Runs the whole pipeline (GenIR -> AllocBuffer -> SubstituteTemps -> CodeGen)
+// on a * b + c * 2 and compares it with a hand-written loop.
+void Bench(std::size_t n, int repeat) {
+    Tensor a = MakeTensor(100, Shape{n});
+    Tensor b = MakeTensor(101, Shape{n});
+    Tensor c = MakeTensor(102, Shape{n});
+    for (std::size_t i = 0; i < n; ++i) {
+        a.data()[i] = Element(i % 17);
+        b.data()[i] = Element(i % 5) * 0.5f;
+        c.data()[i] = Element(i % 3);
+    }
+
+    auto expr = yap::make_terminal(a) * yap::make_terminal(b) + yap::make_terminal(c) * 2;
+    Tensor result = MakeTensor(0, Shape{});
+    double pipeline = TimeMs(repeat, [&] {
+        auto gen = LowerIR(expr);
+        auto &&map = AllocBuffer(gen.mIRList, false);
+        result = CodeGen(SubstituteTemps(gen.mIRList, map));
+    });
+
+    Tensor ref = MakeTensor(200, Shape{n});
+    double loop = TimeMs(repeat, [&] {
+        for (std::size_t i = 0; i < n; ++i)
+            ref.data()[i] = a.data()[i] * b.data()[i] + c.data()[i] * 2;
+    });
+
+    assert(result.shape == ref.shape);
+    for (std::size_t i = 0; i < n; ++i)
+        assert(result.data()[i] == ref.data()[i]);
+
+    printf("a * b + c * 2 over %zu floats: pipeline %.3f ms, hand-written loop %.3f ms\n", n, pipeline, loop);
+}
+
+// Compares the buffers AllocBuffer needs for expr with one buffer per temp.
+template <typename Expr>
+void ReportBufferReuse(const char *name, const Expr &expr) {
+    auto gen = LowerIR(expr);
+    BufferPool<Tensor> pool;
+    AllocBuffer(gen.mIRList, pool, false);
+    printf("%-36s %2zu temps: %2zu buffers, %6zu KiB (naive %2zu buffers, %6zu KiB)\n", name,
+           pool.mTemps, pool.mBuffers.size(), pool.Elements() * sizeof(Element) >> 10, pool.mTemps, pool.mNaiveElements * sizeof(Element) >> 10);
 }
 
 int main() {
     // print_func_result_type(foo);
-    long a = 10;
-    long b = 20;
+    Tensor a = MakeTensor(100, Shape{4, 4});
+    Tensor b = MakeTensor(101, Shape{4, 4});
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        a.data()[i] = Element(i);
+        b.data()[i] = Element(10 * i);
+    }
     {
         auto call_foo = yap::make_terminal(foo);
         // auto expr = yap::make_terminal(a) * 2 + call_foo() + yap::make_terminal(b) * 3;
         auto expr = yap::make_terminal(a) + yap::make_terminal(b) * 3;
         yap::print(std::cout, expr);
-        auto gen = yap::transform(expr, GenIR{hana::make_tuple(), hana::make_tuple()});
+        auto gen = LowerIR(expr);
         printf("After transform:\n");
         PrintIRList(gen.mIRList);
 
@@ -256,7 +446,58 @@ int main() {
         printf("After AllocBuffer and SubstituteTemps:\n");
         PrintIRList(irList2);
 
-        CodeGen(irList2);
-        // printf("result = %ld\n", result);
+        auto result = CodeGen(irList2);
+        DefaultTrace::Dump(std::cout);
+        std::cout << "result = " << result << std::endl;
+        for (std::size_t i = 0; i < a.size(); ++i)
+            assert(result.data()[i] == a.data()[i] + b.data()[i] * 3);
     }
+
+    {
+        // Constant subtrees and identities are simplified before GenIR, which
+        // saves both kernels and temps
+        auto ta = yap::make_terminal(a), tb = yap::make_terminal(b);
+        auto expr = (ta * 1_c + tb * 0_c) * (2_c * 3_c) + (tb + 0_c) * (4 + yap::make_terminal(5));
+        auto gen = LowerIR(expr);
+        auto simplified = Simplify(expr);
+        printf("After Simplify:\n");
+        yap::print(std::cout, simplified);
+        auto gen2 = LowerIR(simplified);
+        BufferPool<Tensor> pool;
+        auto &&map = AllocBuffer(gen2.mIRList, pool, false);
+        auto result = CodeGen(SubstituteTemps(gen2.mIRList, map));
+        printf("IR list length: %zu before Simplify, %zu after (%zu buffers)\n",
+               std::size_t(hana::length(gen.mIRList)), std::size_t(hana::length(gen2.mIRList)), pool.mBuffers.size());
+        for (std::size_t i = 0; i < a.size(); ++i)
+            assert(result.data()[i] == a.data()[i] * 6 + b.data()[i] * 9);
+    }
+    {
+        // Expressions that simplify to a single terminal still lower to an IR;
+        // a tensor times 0_c keeps its shape
+        auto ta = yap::make_terminal(a);
+        auto simplified = Simplify(ta * 1_c);
+        auto gen = LowerIR(simplified);
+        auto result = CodeGen(SubstituteTemps(gen.mIRList, AllocBuffer(gen.mIRList, false)));
+        for (std::size_t i = 0; i < a.size(); ++i)
+            assert(result.data()[i] == a.data()[i]);
+        auto folded = Simplify(yap::make_terminal(2_c) * 3_c);
+        auto gen2 = LowerIR(folded);
+        auto result2 = CodeGen(SubstituteTemps(gen2.mIRList, AllocBuffer(gen2.mIRList, false)));
+        assert(result2.shape.empty() && result2.data()[0] == 6);
+        auto zeros = Simplify(ta * 0_c);
+        auto gen3 = LowerIR(zeros);
+        auto result3 = CodeGen(SubstituteTemps(gen3.mIRList, AllocBuffer(gen3.mIRList, false)));
+        assert(result3.shape == a.shape && result3.data()[a.size() - 1] == 0);
+    }
+    {
+        Tensor tx = MakeTensor(102, Shape{1 << 16});
+        Tensor ty = MakeTensor(103, Shape{1 << 16});
+        auto x = yap::make_terminal(tx), y = yap::make_terminal(ty);
+        ReportBufferReuse("x + y * 2 + x * 3 + y + ... (chain)", x + y * 2 + x * 3 + y + x * y + x + y * 4 + x);
+        ReportBufferReuse("(x * y + y * x) * (x * x + y * y)", (x * y + y * x) * (x * x + y * y));
+        ReportBufferReuse("x * (y + x * (y + x * (y + x * y)))", x * (y + x * (y + x * (y + x * y))));
+    }
+
+    Bench(1 << 12, 10000);
+    Bench(1 << 22, 20);
 }
@@ -4,21 +4,20 @@
 #include <boost/yap/print.hpp>
 #include <cassert>
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <vector>
+
+#include "../accumulate.hpp"
+#include "../simplify.hpp"
+#include "../temps.hpp"
+#include "../trace.hpp"
 
 namespace yap = boost::yap;
 namespace hana = boost::hana;
 using namespace hana::literals;
 
-// A placeholder for temporary variables
-template <long long I>
-struct temp_placeholder : boost::hana::llong<I> {
-    friend std::ostream& operator<< (std::ostream& os, const temp_placeholder<I> &p) {
-        os << "temp" << I;
-        return os;
-    }
-};
-
 auto const _0 = yap::make_terminal(temp_placeholder<0>{});
 auto const _1 = yap::make_terminal(temp_placeholder<1>{});
 auto const _2 = yap::make_terminal(temp_placeholder<2>{});
@@ -38,17 +37,11 @@ auto PrintIRList(IRList &&irList) {
 template <typename IRGenerator>
 auto PrintIRGen(IRGenerator &&irGen) {
     printf("IR Generated:\n");
-    // using T = typename std::remove_reference<decltype(irGen)>::type;
-    // auto indecies = hana::make_tuple(std::make_index_sequence<hana::length(typename T::IRListSeq)>{});
-    auto indicies = hana::make_tuple(hana::size_c<0>, hana::size_c<1>);
+    auto indicies = hana::make_range(hana::size_c<0>, hana::length(irGen.mIRList));
     hana::for_each(indicies, [&irGen](auto i) {
         std::cout << i << std::endl;
         yap::print(std::cout, irGen.mIRList[i]);
-        if constexpr (hana::contains(decltype(hana::keys(irGen.mResources))(), i)) {
-            auto resource = irGen.mResources[i];
-            std::cout << "resource: " << resource << std::endl;
-        }
-
+        std::cout << "resource: " << irGen.mResources[i] << std::endl;
     });
 }
 
@@ -102,129 +95,159 @@ std::ostream& operator<< (std::ostream &os, Resource r) {
 
 struct ResourceList {};
 
-template <typename Sequence, typename Stack, typename MapResources, typename MapDeps, long long I = 1>
+// Memory moves between global memory and the compute unit.  Loads run on
+// PIPE_M1, stores on PIPE_M2, and everything else on PIPE_ALU.
+struct Load {
+    template <typename T>
+    T operator() (const T &t) const { return t; }
+
+    friend std::ostream& operator<< (std::ostream &os, const Load &) { return os << "Load"; }
+};
+
+struct Store {
+    template <typename T>
+    T operator() (const T &t) const { return t; }
+
+    friend std::ostream& operator<< (std::ostream &os, const Store &) { return os << "Store"; }
+};
+
+template <typename Callable>
+struct ResourceOf { static constexpr Resource value = PIPE_ALU; };
+
+template <>
+struct ResourceOf<Load> { static constexpr Resource value = PIPE_M1; };
+
+template <>
+struct ResourceOf<Store> { static constexpr Resource value = PIPE_M2; };
+
+// The pieces LowerToIRs() (see accumulate.hpp) lowers an expression to: IRs
+// _temp = lhs op rhs and _temp = call, whose operands are terminals.  Records
+// the pipe each IR runs on as it is made.
+template <typename Trace = DefaultTrace>
 struct GenIR {
-    Sequence mIRList;
-    Stack mStack;
-    MapResources mResources;
-    MapDeps mDepList;
-    static const long long placeholder_index = I;
-
-    using IRListSeq = Sequence;
-    // static constexpr auto length = hana::length(Sequence{});
-
-    constexpr GenIR(const Sequence &seq, const Stack &stk, const MapResources &res, const MapDeps &deps) :
-        mIRList(seq), mStack(stk), mResources(res), mDepList(deps) {
-        printf("GenIR constructor:\n");
-        // printf("mIRList: "); hana::for_each(mIRList, [](const auto &ir) {yap::print(std::cout, ir);});
-        // printf("mStack: "); hana::for_each(mStack, [](const auto &expr) {yap::print(std::cout, expr);});
-        printf("mResources: "); hana::for_each(mResources, [](const auto &pair) {std::cout << hana::first(pair) << std::endl;});
-    }
+    std::vector<Resource> mResources; // mResources[k] is the pipe of the k-th IR
 
     template <typename T>
-    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&t) {
-        // printf("GenIR: terminal matched\n");
-        // Push result onto stack
-        auto stack = hana::append(mStack, std::move(yap::make_terminal(t)));
-        return GenIR<decltype(mIRList), decltype(stack), decltype(mResources), decltype(mDepList), I>{mIRList, stack, mResources, mDepList};
+    auto Operand(T &&t) {
+        Trace::Record("GenIR: terminal matched");
+        return yap::make_terminal(t);
     }
 
-    template <yap::expr_kind Kind, typename Expr1, typename Expr2>
-    auto operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) {
-        // printf("GenIR: binary op matched\n");
-        auto genLhs = yap::transform(yap::as_expr(lhs), *this);
-        // printf("genLhs:\n"); PrintIRList(genLhs.mIRList);
-        auto genRhs = yap::transform(yap::as_expr(rhs), genLhs);
-        // printf("genRhs:\n"); PrintIRList(genRhs.mIRList);
-
-        auto constexpr index = decltype(genRhs)::placeholder_index;
-        auto temp = yap::make_terminal(temp_placeholder<index>{});
-        auto assign = yap::make_expression<yap::expr_kind::assign>(std::move(temp),
-            yap::make_expression<Kind>(
-                std::move(hana::back(genLhs.mStack)),  // lhs's result
-                std::move(hana::back(genRhs.mStack))   // rhs's result
-            )
-        );
-        // printf("append:\n"); yap::print(std::cout, assign);
-        auto newIRList = hana::append(genRhs.mIRList, std::move(assign));
-
-        // std::cout << "Add resource: " << hana::length(newIRList) - hana::size_c<1> << std::endl;
-        auto newResources = hana::insert(genRhs.mResources, hana::make_pair(hana::length(newIRList) - hana::size_c<1>, PIPE_ALU));
-
-        // Skip poping operands from mStack
-        // Push result onto stack
-        auto newStack = hana::append(mStack, std::move(temp));
-
-        return GenIR<decltype(newIRList), decltype(newStack), decltype(newResources), decltype(mDepList), index + 1>(newIRList, newStack, newResources, mDepList);
+    template <long long I>
+    auto Temp() {
+        return yap::make_terminal(temp_placeholder<I>{});
     }
 
-    template <typename Callable, typename ...Args>
-    auto operator() (yap::expr_tag<yap::expr_kind::call>, Callable &&callable, Args &&...args) {
-        // printf("GenIR: call matched\n");
-        auto assign = yap::make_expression<yap::expr_kind::assign>(
-            yap::make_terminal(temp_placeholder<I>{}),
-            yap::make_expression<yap::expr_kind::call>(yap::as_expr(callable), yap::as_expr(args)...)
-        );
-        // printf("assign:\n"); yap::print(std::cout, assign);
-        auto newIRList = hana::append(mIRList, std::move(assign));
-        auto newStack = hana::append(mStack, std::move(yap::make_terminal(temp_placeholder<I>{})));
-        return GenIR<decltype(newIRList), decltype(newStack), decltype(mResources), decltype(mDepList), I + 1>{newIRList, newStack, mResources, mDepList};
+    template <long long I, yap::expr_kind Kind, typename Expr1, typename Expr2>
+    auto Binary(Expr1 &&lhs, Expr2 &&rhs) {
+        Trace::Record("GenIR: binary op matched");
+        mResources.push_back(PIPE_ALU);
+        return yap::make_expression<yap::expr_kind::assign>(
+            Temp<I>(), yap::make_expression<Kind>(std::move(lhs), std::move(rhs)));
     }
 
+    template <long long I, typename Callable, typename ...Args>
+    auto Call(Callable &&callable, Args &&...args) {
+        Trace::Record("GenIR: call matched");
+        mResources.push_back(ResourceOf<std::decay_t<Callable>>::value);
+        return yap::make_expression<yap::expr_kind::assign>(
+            Temp<I>(), yap::make_expression<yap::expr_kind::call>(yap::as_expr(callable), std::move(args)...));
+    }
 };
 
-template <typename Map>
+template <typename IRList>
+struct LoweredIR {
+    IRList mIRList;
+    std::vector<Resource> mResources;
+};
+
+// Lowers expr.  mIRList of the result is a hana::tuple of the IRs.
+template <typename Trace = DefaultTrace, typename Expr>
+auto LowerIR(Expr &&expr) {
+    GenIR<Trace> gen;
+    auto irList = LowerToIRs(gen, yap::as_expr(expr));
+    return LoweredIR<decltype(irList)>{std::move(irList), std::move(gen.mResources)};
+}
+
+// Acquires a tensor from the pool for the temp an IR defines.
+template <typename Trace = DefaultTrace>
 struct AllocBufferXform {
-    const Map &mMap; // A map from TempVar to expression
+    std::map<long long, Tensor> &mTensors; // Temp => its tensor
+    BufferPool<Tensor> &mPool;
 
-    constexpr AllocBufferXform(const Map &map) : mMap(map) {}
+    AllocBufferXform(std::map<long long, Tensor> &tensors, BufferPool<Tensor> &pool) : mTensors(tensors), mPool(pool) {}
+
+    // Every temp holds a single value
+    Tensor AcquireTensor(long long temp) {
+        return mPool.Acquire(temp, 1, [](int id, std::size_t) { return MakeTensor(id); });
+    }
 
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, Expr1 &&lhs, Expr2 &&rhs) {
-        printf("AllocBufferXform: common assign matched\n");
+        Trace::Record("AllocBufferXform: common assign matched");
         assert(false && "Should not reach here");
     }
 
     template <typename Expr2, long long I>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp, Expr2 &&rhs) const {
-        printf("AllocBufferXform: assign to temp matched\n");
+        Trace::Record("AllocBufferXform: assign to temp matched");
         assert(false && "Should not reach here");
     }
 
     template <long long I, yap::expr_kind Binary, typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp,
                      yap::expression<Binary, hana::tuple<Expr1, Expr2>> const &binaryExpr) {
-        printf("AllocBufferXform: assign _temp = lhs op rhs matched\n");
+        Trace::Record("AllocBufferXform: assign _temp = lhs op rhs matched");
         auto lhs = yap::left(binaryExpr);
         auto rhs = yap::right(binaryExpr);
         static_assert(decltype(lhs)::kind == yap::expr_kind::terminal);
         static_assert(decltype(rhs)::kind == yap::expr_kind::terminal);
         // TODO: use rhs's info to infer information for tensor
-        auto tensor = MakeTensor(I);
-        auto expr = yap::make_terminal(std::move(tensor));
-        return hana::insert(mMap, hana::make_pair(hana::llong_c<I>, expr));
+        auto tensor = AcquireTensor(I);
+        mTensors.emplace(I, std::move(tensor));
     }
 
     template <long long I, typename Fn, typename ...Args>
     auto operator() (yap::expr_tag<yap::expr_kind::assign>, temp_placeholder<I> const &temp,
                      yap::expression<yap::expr_kind::call, hana::tuple<Fn, Args...>> const &callExpr) {
-        printf("AllocBufferXform: assign _temp = call matched\n");
-        auto tensor = MakeTensor(I);
-        auto expr = yap::make_terminal(std::move(tensor));
-        return hana::insert(mMap, hana::make_pair(hana::llong_c<I>, expr));
+        Trace::Record("AllocBufferXform: assign _temp = call matched");
+        auto tensor = AcquireTensor(I);
+        mTensors.emplace(I, std::move(tensor));
     }
 };
 
+// The temp an IR _temp = ... defines, as hana::llong_c<I>.
+template <typename IR>
+constexpr auto TempOf(IR const &ir) {
+    return hana::llong_c<std::decay_t<decltype(yap::value(yap::left(ir)))>::value>;
+}
+
 // Given a sequence of IRList, assign a tensor for each temp_placeholder and returns a map
-// recording them.
+// recording them.  Temps share buffers from pool according to their liveness.
 template <typename Sequence>
-auto AllocBuffer(const Sequence &irList) {
-    // Given a map and an expression, returns a new map containing placeholder => tensor
-    auto fn = [](auto &&map, auto &&ir) -> decltype(auto) {
-        return yap::transform(ir, AllocBufferXform{map});
-    };
+auto AllocBuffer(const Sequence &irList, BufferPool<Tensor> &pool) {
+    Liveness live = ComputeLiveness(irList);
+    std::map<long long, Tensor> tensors;
+    // The state of the fold is the index of the IR
+    hana::fold(irList, std::size_t(0), [&](std::size_t k, auto const &ir) {
+        yap::transform(ir, AllocBufferXform<>{tensors, pool});
+        // Operands are released only after the IR's own temp is allocated, so
+        // an IR never writes a buffer it reads.
+        for (auto temp : live.mDying[k])
+            pool.Release(temp);
+        return k + 1;
+    });
+    printf("AllocBuffer: %zu temps in %zu buffers\n", pool.mTemps, pool.mBuffers.size());
+    // The map is built once, from the temps of all the IRs
+    return hana::unpack(irList, [&tensors](auto const &...irs) {
+        return hana::make_map(hana::make_pair(TempOf(irs), yap::make_terminal(std::move(tensors.at(TempOf(irs)))))...);
+    });
+}
 
-    return hana::fold(irList, hana::make_map(), fn);
+template <typename Sequence>
+auto AllocBuffer(const Sequence &irList) {
+    BufferPool<Tensor> pool;
+    return AllocBuffer(irList, pool);
 }
 
 template <typename ExprMap>
@@ -249,18 +272,22 @@ auto SubstituteTemps(Sequence &&irList, Map &&map) {
     });
 }
 
+template <typename Trace = DefaultTrace>
 struct CodeGenXform {
     template <yap::expr_kind BinaryOP, typename Expr1, typename Expr2>
     auto operator()(yap::expr_tag<boost::yap::expr_kind::assign>, Tensor const &lhs,
                     yap::expression<BinaryOP, hana::tuple<Expr1, Expr2>> const &rhs) {   
-        printf("CodeGenXform: tensor = expr1 op expr2 matched\n");
+        Trace::Record("CodeGenXform: tensor = expr1 op expr2 matched");
         if constexpr (BinaryOP == yap::expr_kind::plus) {
             // memory[lhs.id] = yap::evaluate(yap::left(rhs) + yap::right(rhs));
-            std::cout << "Executing TensorAdd`" << std::endl;
+            Trace::Record("Executing TensorAdd");
         }
         else if constexpr (BinaryOP == yap::expr_kind::multiplies) {
             // memory[lhs.id] = yap::evaluate(yap::left(rhs) * yap::right(rhs));
-            std::cout << "Executing TensorMul" << std::endl;
+            Trace::Record("Executing TensorMul");
+        }
+        else if constexpr (BinaryOP == yap::expr_kind::shift_left) {
+            Trace::Record("Executing TensorShl");
         }
         // std::cout << lhs << std::endl;
         // return memory[lhs.id];
@@ -270,10 +297,167 @@ struct CodeGenXform {
 template <typename Sequence>
 auto CodeGen(Sequence &&irList) {
     hana::for_each(irList, [](const auto &ir) {
-        yap::transform(ir, CodeGenXform{});
+        yap::transform(ir, CodeGenXform<>{});
     });
 }
 
+// Estimated cycles an IR occupies its pipe, and the cost of a sync between pipes.
+int Latency(Resource r) {
+    switch (r) {
+        case PIPE_M1:
+        case PIPE_M2:
+            return 8;
+        default:
+            return 4;
+    }
+}
+
+constexpr int kSyncLatency = 1;
+constexpr int kNumResources = 3;
+
+// One entry of a pipe's queue: either IR mIR, or a sync that makes the pipe
+// wait until IR mIR has finished on pipe mWaitOn.
+struct ScheduleEntry {
+    bool mSync;
+    std::size_t mIR;
+    Resource mWaitOn;
+    int mStart;
+    int mEnd;
+};
+
+struct Schedule {
+    std::vector<ScheduleEntry> mQueues[kNumResources];
+    int mMakespan = 0;
+    int mSerial = 0;         // Running every IR one after another
+    std::size_t mSyncs = 0;
+    std::size_t mCrossEdges = 0;
+};
+
+// Builds the dependency DAG of an IR list from its temp def/use chains:
+// preds[k] holds the IRs whose temps IR k reads.
+template <typename Sequence>
+std::vector<std::vector<std::size_t>> BuildDeps(const Sequence &irList) {
+    std::vector<std::vector<std::size_t>> preds;
+    std::map<long long, std::size_t> defOf;
+    hana::for_each(irList, [&](auto const &ir) {
+        CollectTempUses uses;
+        yap::transform(yap::right(ir), uses);
+        std::vector<std::size_t> p;
+        for (auto temp : uses.mTemps) {
+            if (std::find(p.begin(), p.end(), defOf.at(temp)) == p.end())
+                p.push_back(defOf.at(temp));
+        }
+        defOf[yap::value(yap::left(ir))] = preds.size();
+        preds.push_back(p);
+    });
+    return preds;
+}
+
+// List scheduler: every pipe executes its queue in order, and IRs on
+// different pipes run concurrently.  At each step the ready IR that can start
+// earliest is appended to its pipe's queue, ties going to the IR with the
+// longest path to the end of the DAG.  A sync is inserted only for an edge
+// between pipes that is not already covered, i.e. when the consumer's queue
+// has not yet waited for that IR, or a later one, on the producer's pipe.
+template <typename IRGenerator>
+Schedule ListSchedule(IRGenerator &&irGen) {
+    auto preds = BuildDeps(irGen.mIRList);
+    std::size_t n = preds.size();
+
+    std::vector<Resource> const &resource = irGen.mResources;
+
+    // Priority: the latency of the longest path from an IR to the end
+    std::vector<int> priority(n, 0);
+    for (std::size_t k = n; k-- > 0;) {
+        priority[k] += Latency(resource[k]);
+        for (auto p : preds[k])
+            priority[p] = std::max(priority[p], priority[k]);
+    }
+
+    Schedule schedule;
+    std::vector<int> finish(n, -1);
+    std::vector<std::size_t> position(n, 0);       // Index of the IR in its pipe's queue
+    std::vector<std::size_t> count(kNumResources, 0);
+    int pipeFree[kNumResources] = {0};
+    // waited[q][r]: number of IRs of pipe r that pipe q has synced with so far
+    std::size_t waited[kNumResources][kNumResources] = {{0}};
+
+    // The last IR on each other pipe that k must sync with, if any
+    auto syncsFor = [&](std::size_t k) {
+        std::vector<std::size_t> syncs;
+        Resource q = resource[k];
+        for (int r = 0; r < kNumResources; ++r) {
+            if (r == q)
+                continue;
+            long last = -1;
+            for (auto p : preds[k]) {
+                if (resource[p] == r && (last < 0 || position[p] > position[last]))
+                    last = p;
+            }
+            if (last >= 0 && position[last] + 1 > waited[q][r])
+                syncs.push_back(last);
+        }
+        return syncs;
+    };
+    auto earliestStart = [&](std::size_t k) {
+        int start = pipeFree[resource[k]];
+        for (auto p : preds[k])
+            start = std::max(start, finish[p]);
+        return start;
+    };
+
+    for (std::size_t done = 0; done < n; ++done) {
+        long best = -1;
+        int bestStart = 0;
+        for (std::size_t k = 0; k < n; ++k) {
+            if (finish[k] >= 0 || std::any_of(preds[k].begin(), preds[k].end(), [&](auto p) { return finish[p] < 0; }))
+                continue;
+            int start = earliestStart(k) + int(syncsFor(k).size()) * kSyncLatency;
+            if (best < 0 || start < bestStart || (start == bestStart && priority[k] > priority[best])) {
+                best = k;
+                bestStart = start;
+            }
+        }
+
+        Resource q = resource[best];
+        auto &queue = schedule.mQueues[q];
+        // The syncs run back to back on the in-order queue, right before best.
+        auto syncs = syncsFor(best);
+        int syncStart = bestStart - int(syncs.size()) * kSyncLatency;
+        for (auto p : syncs) {
+            queue.push_back(ScheduleEntry{true, p, resource[p], syncStart, syncStart + kSyncLatency});
+            syncStart += kSyncLatency;
+            waited[q][resource[p]] = position[p] + 1;
+            schedule.mSyncs++;
+        }
+        for (auto p : preds[best])
+            schedule.mCrossEdges += resource[p] != q;
+
+        finish[best] = bestStart + Latency(q);
+        position[best] = count[q]++;
+        pipeFree[q] = finish[best];
+        queue.push_back(ScheduleEntry{false, std::size_t(best), q, bestStart, finish[best]});
+        schedule.mMakespan = std::max(schedule.mMakespan, finish[best]);
+        schedule.mSerial += Latency(q);
+    }
+    return schedule;
+}
+
+void PrintSchedule(const Schedule &schedule) {
+    printf("Schedule:\n");
+    for (int r = 0; r < kNumResources; ++r) {
+        std::cout << Resource(r) << ":" << std::endl;
+        for (auto const &e : schedule.mQueues[r]) {
+            if (e.mSync)
+                std::cout << "    [" << e.mStart << ", " << e.mEnd << ") sync: wait " << e.mWaitOn << " IR " << e.mIR << std::endl;
+            else
+                std::cout << "    [" << e.mStart << ", " << e.mEnd << ") IR " << e.mIR << std::endl;
+        }
+    }
+    printf("Estimated makespan %d cycles (serial %d), %zu syncs for %zu cross-pipe edges\n",
+           schedule.mMakespan, schedule.mSerial, schedule.mSyncs, schedule.mCrossEdges);
+}
+
 int foo() { return 0; }
 
 int bar(int arg) { return 1; }
@@ -284,7 +468,7 @@ using result_t = std::result_of_t<Fn()>;
 template <typename Fn>
 auto print_func_result_type(Fn &&fn) {
     using t = std::result_of_t<Fn()>;
-    PrintTypeName<t>();
+    std::cout << TypeName<t>() << std::endl;
 }
 
 int main() {
@@ -296,7 +480,7 @@ int main() {
         // auto expr = yap::make_terminal(a) * 2 + call_foo() + yap::make_terminal(b) * 3;
         auto expr = yap::make_terminal(a) + yap::make_terminal(b) * 3;
         yap::print(std::cout, expr);
-        auto gen = yap::transform(expr, GenIR{hana::make_tuple(), hana::make_tuple(), hana::make_map(), hana::make_map()});
+        auto gen = LowerIR(expr);
         printf("After transform:\n");
         // PrintIRList(gen.mIRList);
         PrintIRGen(gen);
@@ -307,6 +491,46 @@ int main() {
         PrintIRList(irList2);
 
         CodeGen(irList2);
+        DefaultTrace::Dump(std::cout);
         // printf("result = %ld\n", result);
     }
+    {
+        long c = 30;
+        auto load = yap::make_terminal(Load{});
+        auto store = yap::make_terminal(Store{});
+        auto expr = store(load(a) * load(b) + load(c) * 2);
+        auto gen = LowerIR(expr);
+        DefaultTrace::Dump(std::cout);
+        printf("After transform:\n");
+        PrintIRGen(gen);
+        auto schedule = ListSchedule(gen);
+        PrintSchedule(schedule);
+        // The load of c on PIPE_M1 overlaps a * b on PIPE_ALU, which saves
+        // the two cycles over running every IR in turn.
+        assert(schedule.mMakespan == 42 && schedule.mSerial == 44);
+        assert(schedule.mSyncs == 3 && schedule.mCrossEdges == 4);
+        assert(schedule.mMakespan < schedule.mSerial);
+
+        // The add reads a temp from each other pipe, so two syncs precede it.
+        auto gen2 = LowerIR(load(a) + store(load(b)));
+        auto schedule2 = ListSchedule(gen2);
+        PrintSchedule(schedule2);
+        [[maybe_unused]] auto const &alu = schedule2.mQueues[PIPE_ALU];
+        assert(alu.size() == 3 && alu[0].mSync && alu[1].mSync);
+        assert(alu[0].mEnd == alu[1].mStart && alu[1].mEnd == alu[2].mStart);
+        assert(schedule2.mMakespan == 23 && schedule2.mSyncs == 3);
+    }
+    {
+        // Constant subtrees, identities and multiplications by powers of two
+        // are simplified before GenIR
+        auto expr = (yap::make_terminal(a) * 1_c + yap::make_terminal(b) * 0_c) * 8_c +
+                    2_c * (yap::make_terminal(b) * (3 + yap::make_terminal(4)));
+        auto simplified = Simplify(expr);
+        printf("After Simplify:\n");
+        yap::print(std::cout, simplified);
+        auto gen = LowerIR(simplified);
+        auto &&map = AllocBuffer(gen.mIRList);
+        CodeGen(SubstituteTemps(gen.mIRList, map));
+        DefaultTrace::Dump(std::cout);
+    }
 }
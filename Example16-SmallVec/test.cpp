@@ -0,0 +1,317 @@
+#include <boost/yap/yap.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace yap = boost::yap;
+
+// Widest SIMD register we may assume for the target.
+#if defined(__AVX512F__)
+constexpr std::size_t kSimdRegisterBytes = 64;
+#elif defined(__AVX__)
+constexpr std::size_t kSimdRegisterBytes = 32;
+#else
+constexpr std::size_t kSimdRegisterBytes = 16;
+#endif
+
+constexpr std::size_t RoundUpPow2(std::size_t n) {
+    std::size_t p = 1;
+    while (p < n)
+        p *= 2;
+    return p;
+}
+
+template <typename T, std::size_t Lanes>
+struct VectorOf {
+    typedef T type __attribute__((vector_size(Lanes * sizeof(T))));
+};
+
+// Describes the vector registers a small_vec<T, N> is mapped onto: as many
+// lanes per register as fit, in N / lanes registers.  Only widths that
+// exactly fill whole registers are mapped; padding e.g. N = 3 up to 4 lanes
+// measured slower than the scalar code.
+template <typename T, std::size_t N>
+struct SimdTraits {
+    static constexpr std::size_t lanes = std::min(N, kSimdRegisterBytes / sizeof(T));
+    static constexpr std::size_t bytes = lanes * sizeof(T);
+    static constexpr bool enabled = std::is_arithmetic<T>::value && bytes == RoundUpPow2(bytes) &&
+                                    bytes >= 16 && N % lanes == 0;
+    // Rounded up so that the type exists when the traits are not enabled.
+    using type = typename VectorOf<T, RoundUpPow2(lanes)>::type;
+};
+
+template <yap::expr_kind Kind, typename L, typename R>
+constexpr auto ApplyOp(L const &l, R const &r) {
+    if constexpr (Kind == yap::expr_kind::plus)
+        return l + r;
+    else if constexpr (Kind == yap::expr_kind::minus)
+        return l - r;
+    else if constexpr (Kind == yap::expr_kind::multiplies)
+        return l * r;
+    else if constexpr (Kind == yap::expr_kind::divides)
+        return l / r;
+    else
+        static_assert(Kind == yap::expr_kind::plus, "Unsupported operator in small_vec expression");
+}
+
+// The tarray.cpp/vec3.cpp way: rebuild the expression with the Nth element of
+// every array as a terminal and then evaluate it.  Kept as the baseline.
+struct take_nth {
+    template <typename T, std::size_t N>
+    auto operator() (yap::terminal<yap::expression, std::array<T, N>> const &expr) {
+        T x = yap::value(expr)[n];
+        // The move forces the terminal to store the value of x, not a reference.
+        return yap::make_terminal(std::move(x));
+    }
+
+    std::size_t n;
+};
+
+// Evaluates the Ith component of an expression directly, without building an
+// intermediate expression tree.  I is a template parameter so that every
+// component access is resolved at compile time.
+template <std::size_t I>
+struct EvalNth {
+    template <typename T, std::size_t N>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, std::array<T, N> const &a) const {
+        static_assert(I < N, "Component index out of range");
+        return a[I];
+    }
+
+    template <typename T>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, T const &t) const {
+        return t;
+    }
+
+    template <typename Expr>
+    auto operator() (yap::expr_tag<yap::expr_kind::negate>, Expr &&expr) const {
+        return -yap::transform(yap::as_expr(expr), *this);
+    }
+
+    template <yap::expr_kind Kind, typename Expr1, typename Expr2>
+    auto operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) const {
+        return ApplyOp<Kind>(yap::transform(yap::as_expr(lhs), *this),
+                             yap::transform(yap::as_expr(rhs), *this));
+    }
+};
+
+// Evaluates lanes [offset, offset + lanes) of an expression in one vector
+// register of type V: arrays are loaded, scalars are broadcast, and every
+// operator becomes one vector instruction.
+template <typename T, std::size_t N>
+struct SimdEval {
+    static constexpr std::size_t lanes = SimdTraits<T, N>::lanes;
+    using V = typename SimdTraits<T, N>::type;
+
+    static V Splat(T x) { return V{} + x; }
+
+    // One unaligned vector load, since small_vec is only aligned to U, and a
+    // lane-wise conversion if U is not T.
+    template <typename U>
+    V Load(std::array<U, N> const &a) const {
+        typename VectorOf<U, lanes>::type v;
+        std::memcpy(&v, a.data() + offset, sizeof(v));
+        return __builtin_convertvector(v, V);
+    }
+
+    template <typename U>
+    V operator() (yap::expr_tag<yap::expr_kind::terminal>, std::array<U, N> const &a) const {
+        return Load(a);
+    }
+
+    template <typename U>
+    V operator() (yap::expr_tag<yap::expr_kind::terminal>, U const &u) const {
+        return Splat(static_cast<T>(u));
+    }
+
+    template <typename Expr>
+    V operator() (yap::expr_tag<yap::expr_kind::negate>, Expr &&expr) const {
+        return -yap::transform(yap::as_expr(expr), *this);
+    }
+
+    template <yap::expr_kind Kind, typename Expr1, typename Expr2>
+    V operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) const {
+        return ApplyOp<Kind>(yap::transform(yap::as_expr(lhs), *this),
+                             yap::transform(yap::as_expr(rhs), *this));
+    }
+
+    std::size_t offset;
+};
+
+template <typename T, std::size_t N>
+using small_vec_terminal = yap::expression<
+    yap::expr_kind::terminal,
+    boost::hana::tuple<std::array<T, N>>
+>;
+
+template <typename T, std::size_t N>
+struct small_vec;
+
+template <typename T, std::size_t N, typename Expr>
+small_vec<T, N> & AssignTakeNth(small_vec<T, N> &dst, Expr const &e) {
+    decltype(auto) expr = yap::as_expr(e);
+    for (std::size_t n = 0; n < N; ++n)
+        dst[n] = yap::evaluate(yap::transform(expr, take_nth{n}));
+    return dst;
+}
+
+// Declared inline: GCC's -O2 limit for inlining functions not declared
+// inline left this out of line once it had two callers, and the call per
+// assignment then cost more than the unrolling saved.
+template <typename T, std::size_t N, typename Expr, std::size_t ...Is>
+inline void AssignUnrolledImpl(small_vec<T, N> &dst, Expr const &expr, std::index_sequence<Is...>) {
+    ((dst[Is] = static_cast<T>(yap::transform(expr, EvalNth<Is>{}))), ...);
+}
+
+template <typename T, std::size_t N, typename Expr>
+small_vec<T, N> & AssignUnrolled(small_vec<T, N> &dst, Expr const &e) {
+    AssignUnrolledImpl(dst, yap::as_expr(e), std::make_index_sequence<N>{});
+    return dst;
+}
+
+template <typename T, std::size_t N, typename Expr>
+small_vec<T, N> & AssignSimd(small_vec<T, N> &dst, Expr const &e) {
+    static_assert(SimdTraits<T, N>::enabled, "small_vec does not fill whole SIMD registers");
+    decltype(auto) expr = yap::as_expr(e);
+    // The result may alias an operand (e.g. a = a + b), but a register only
+    // reads the lanes it then stores, so each can be stored as soon as it
+    // has been evaluated.
+    for (std::size_t offset = 0; offset < N; offset += SimdTraits<T, N>::lanes) {
+        auto v = yap::transform(expr, SimdEval<T, N>{offset});
+        std::memcpy(&dst[offset], &v, sizeof(v));
+    }
+    return dst;
+}
+
+// A fixed-size vector of N values of type T.  Assigning an expression to it
+// evaluates the expression in SIMD registers when N fills whole registers,
+// and as N compile-time unrolled scalar evaluations otherwise.
+template <typename T, std::size_t N>
+struct small_vec : small_vec_terminal<T, N> {
+    small_vec() { yap::value(*this).fill(T{}); }
+
+    explicit small_vec(std::array<T, N> const &a) { yap::value(*this) = a; }
+
+    template <typename ...Ts, typename = std::enable_if_t<sizeof...(Ts) == N>>
+    explicit small_vec(Ts ...ts) { yap::value(*this) = {static_cast<T>(ts)...}; }
+
+    T & operator[] (std::ptrdiff_t i)
+    { return yap::value(*this)[i]; }
+
+    T const & operator[] (std::ptrdiff_t i) const
+    { return yap::value(*this)[i]; }
+
+    template <typename Expr>
+    small_vec & operator= (Expr const &expr) {
+        if constexpr (SimdTraits<T, N>::enabled)
+            return AssignSimd(*this, expr);
+        else
+            return AssignUnrolled(*this, expr);
+    }
+
+    friend std::ostream & operator<< (std::ostream &os, small_vec const &v) {
+        os << '{';
+        for (std::size_t i = 0; i < N; ++i)
+            os << (i ? ", " : "") << v[i];
+        return os << '}';
+    }
+};
+
+// The fastest of several timed runs of repeat passes over a, after one pass
+// to warm up the caches and the branch predictors, in ns per assignment.
+template <typename T, std::size_t N, typename Assign>
+double BenchAssign(std::vector<small_vec<T, N>> &a,
+                   std::vector<small_vec<T, N>> const &b,
+                   std::vector<small_vec<T, N>> const &c,
+                   int repeat, Assign &&assign) {
+    auto pass = [&] {
+        for (std::size_t k = 0; k < a.size(); ++k)
+            assign(a[k], b[k] + c[k] * (b[k] + 3 * c[k]));
+        // Keep the compiler from merging the passes.
+        asm volatile("" ::: "memory");
+    };
+    pass();
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeat; ++r)
+            pass();
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / (repeat * a.size());
+        best = run == 0 ? ns : std::min(best, ns);
+    }
+    return best;
+}
+
+template <typename T, std::size_t N>
+void Bench(char const *name) {
+    std::size_t const count = 4096;
+    int const repeat = 200;
+    std::vector<small_vec<T, N>> a(count), b(count), c(count), ref(count);
+    for (std::size_t k = 0; k < count; ++k) {
+        for (std::size_t i = 0; i < N; ++i) {
+            b[k][i] = static_cast<T>((k + i) % 7);
+            c[k][i] = static_cast<T>((k * i) % 5 + 1);
+        }
+    }
+
+    auto takeNth = [](auto &dst, auto const &expr) { AssignTakeNth(dst, expr); };
+    auto unrolled = [](auto &dst, auto const &expr) { AssignUnrolled(dst, expr); };
+    auto assign = [](auto &dst, auto const &expr) { dst = expr; };
+
+    double t0 = BenchAssign(ref, b, c, repeat, takeNth);
+    double t1 = BenchAssign(a, b, c, repeat, unrolled);
+    for (std::size_t k = 0; k < count; ++k)
+        for (std::size_t i = 0; i < N; ++i)
+            assert(a[k][i] == ref[k][i]);
+    double t2 = BenchAssign(a, b, c, repeat, assign);
+    for (std::size_t k = 0; k < count; ++k)
+        for (std::size_t i = 0; i < N; ++i)
+            assert(a[k][i] == ref[k][i]);
+
+    printf("small_vec<%-6s, %2zu>  take_nth %7.2f ns  unrolled %7.2f ns  operator= (%-8s) %7.2f ns\n",
+           name, N, t0, t1, SimdTraits<T, N>::enabled ? "simd" : "unrolled", t2);
+}
+
+template <typename T, std::size_t ...Ns>
+void BenchWidths(char const *name, std::index_sequence<Ns...>) {
+    (Bench<T, Ns>(name), ...);
+}
+
+int main() {
+    small_vec<int, 3> a(3, 1, 2);
+    small_vec<int, 3> b(7, 33, -99);
+    small_vec<int, 3> c(a);
+    std::cout << a << " " << b << " " << c << std::endl;
+
+    a = b + c;
+    std::cout << a << std::endl;
+
+    a = b + c * (b + 3 * c);
+    std::cout << a << std::endl;
+
+    small_vec<double, 4> d(1.0, 2.0, 3.0, 4.0);
+    small_vec<double, 4> e;
+    e = -d / 2 + d;
+    std::cout << e << std::endl;
+
+    // Each register reads only the lanes it stores, so f may be on both sides.
+    small_vec<double, 16> f;
+    for (std::size_t i = 0; i < 16; ++i)
+        f[i] = double(i);
+    f = f * 2 + f;
+    for (std::size_t i = 0; i < 16; ++i)
+        assert(f[i] == 3.0 * i);
+
+    printf("SIMD register: %zu bytes\n", kSimdRegisterBytes);
+    auto const widths = std::index_sequence<2, 3, 4, 8, 16>{};
+    BenchWidths<float>("float", widths);
+    BenchWidths<double>("double", widths);
+    BenchWidths<int>("int", widths);
+}
@@ -0,0 +1,274 @@
+#include <boost/yap/yap.hpp>
+
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace yap = boost::yap;
+
+// vec3 as in vec3.cpp: one 3-vector per terminal, assigned through take_nth.
+struct take_nth
+{
+    template <typename T>
+    auto operator() (yap::terminal<yap::expression, std::array<T, 3>> const & expr)
+    {
+        T x = yap::value(expr)[n];
+        // The move forces the terminal to store the value of x, not a
+        // reference.
+        return yap::make_terminal(std::move(x));
+    }
+
+    std::size_t n;
+};
+
+template <typename T>
+using vec3_terminal = yap::expression<
+    yap::expr_kind::terminal,
+    boost::hana::tuple<std::array<T, 3>>
+>;
+
+template <typename T>
+struct vec3 : vec3_terminal<T>
+{
+    explicit vec3 (T i = 0, T j = 0, T k = 0)
+    {
+        (*this)[0] = i;
+        (*this)[1] = j;
+        (*this)[2] = k;
+    }
+
+    T & operator[] (std::ptrdiff_t i)
+    { return yap::value(*this)[i]; }
+
+    T const & operator[] (std::ptrdiff_t i) const
+    { return yap::value(*this)[i]; }
+
+    template <typename Expr>
+    vec3 & operator= (Expr const & e)
+    {
+        decltype(auto) expr = yap::as_expr(e);
+        (*this)[0] = yap::evaluate(yap::transform(expr, take_nth{0}));
+        (*this)[1] = yap::evaluate(yap::transform(expr, take_nth{1}));
+        (*this)[2] = yap::evaluate(yap::transform(expr, take_nth{2}));
+        return *this;
+    }
+};
+
+// The value held by a vec3_soa terminal: a batch of 3-vectors stored as three
+// contiguous component arrays.
+template <typename T>
+struct Vec3Batch {
+    std::array<std::vector<T>, 3> components;
+
+    std::size_t size() const { return components[0].size(); }
+};
+
+template <yap::expr_kind Kind, typename L, typename R>
+auto ApplyOp(L const &l, R const &r) {
+    if constexpr (Kind == yap::expr_kind::plus)
+        return l + r;
+    else if constexpr (Kind == yap::expr_kind::minus)
+        return l - r;
+    else if constexpr (Kind == yap::expr_kind::multiplies)
+        return l * r;
+    else if constexpr (Kind == yap::expr_kind::divides)
+        return l / r;
+    else
+        static_assert(Kind == yap::expr_kind::plus, "Unsupported operator in vec3 expression");
+}
+
+// Lowers a vec3 expression to one of its components, once per assignment:
+// every batch becomes a pointer to its component array and every single vec3
+// becomes a scalar that is broadcast across the batch.
+template <std::size_t C>
+struct TakeComponent {
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, Vec3Batch<T> const &batch) {
+        T const *data = batch.components[C].data();
+        return yap::make_terminal(std::move(data));
+    }
+
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, std::array<T, 3> const &v) {
+        T x = v[C];
+        return yap::make_terminal(std::move(x));
+    }
+};
+
+// Evaluates element i of a component-lowered expression.  This is a full
+// evaluation (no intermediate tree is built), so the loop around it compiles
+// down to a plain loop over the component arrays.  With the Makefile's -O3,
+// -fopt-info-vec reports that loop as vectorized; at -O2, GCC's very cheap
+// cost model leaves it scalar, since n is not known to be a multiple of the
+// vector width.
+struct EvalAt {
+    template <typename T>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, T const *data) const {
+        return data[i];
+    }
+
+    template <typename T>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, T const &t) const {
+        return t;
+    }
+
+    template <typename Expr>
+    auto operator() (yap::expr_tag<yap::expr_kind::negate>, Expr &&expr) const {
+        return -yap::transform(yap::as_expr(expr), *this);
+    }
+
+    template <yap::expr_kind Kind, typename Expr1, typename Expr2>
+    auto operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) const {
+        return ApplyOp<Kind>(yap::transform(yap::as_expr(lhs), *this),
+                             yap::transform(yap::as_expr(rhs), *this));
+    }
+
+    std::size_t i;
+};
+
+// Records whether all batches in an expression have the given size.
+struct EqualSizes {
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, Vec3Batch<T> const &batch) {
+        if (batch.size() != size)
+            value = false;
+        return 0;
+    }
+
+    std::size_t const size;
+    bool value;
+};
+
+template <typename T>
+using vec3_soa_terminal = yap::expression<
+    yap::expr_kind::terminal,
+    boost::hana::tuple<Vec3Batch<T>>
+>;
+
+// A batch of n 3-vectors stored as structure of arrays.  It accepts the same
+// expressions as vec3 (mixing in single vec3s and scalars, which are
+// broadcast), and assignment runs one loop per component over the whole batch.
+template <typename T>
+struct vec3_soa : vec3_soa_terminal<T>
+{
+    explicit vec3_soa (std::size_t n = 0)
+    {
+        for (auto &c : yap::value(*this).components)
+            c.resize(n);
+    }
+
+    std::size_t size() const { return yap::value(*this).size(); }
+
+    std::vector<T> & component(std::size_t c) { return yap::value(*this).components[c]; }
+    std::vector<T> const & component(std::size_t c) const { return yap::value(*this).components[c]; }
+
+    std::array<T, 3> operator[] (std::size_t i) const
+    { return {component(0)[i], component(1)[i], component(2)[i]}; }
+
+    void set (std::size_t i, std::array<T, 3> const & v)
+    {
+        component(0)[i] = v[0];
+        component(1)[i] = v[1];
+        component(2)[i] = v[2];
+    }
+
+    template <typename Expr>
+    vec3_soa & operator= (Expr const & e)
+    {
+        decltype(auto) expr = yap::as_expr(e);
+        EqualSizes equal{size(), true};
+        yap::transform(expr, equal);
+        assert(equal.value && "vec3_soa batches in an expression must have the same size");
+        AssignComponent<0>(expr);
+        AssignComponent<1>(expr);
+        AssignComponent<2>(expr);
+        return *this;
+    }
+
+private:
+    template <std::size_t C, typename Expr>
+    void AssignComponent (Expr const & expr)
+    {
+        auto lowered = yap::transform(expr, TakeComponent<C>{});
+        T *out = component(C).data();
+        // out may alias an input array (a = a + b), but only at the same
+        // index, so there is no loop-carried dependence.
+#pragma GCC ivdep
+        for (std::size_t i = 0, n = size(); i < n; ++i)
+            out[i] = static_cast<T>(yap::transform(lowered, EvalAt{i}));
+    }
+};
+
+template <typename T>
+std::ostream & operator<< (std::ostream & os, std::array<T, 3> const & v)
+{ return os << '{' << v[0] << ", " << v[1] << ", " << v[2] << '}'; }
+
+template <typename Fn>
+double TimeUs(int repeat, Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+        fn();
+        // Keep the compiler from merging the repetitions.
+        asm volatile("" ::: "memory");
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / repeat;
+}
+
+// The expression is componentwise, so over a std::vector<vec3<float>> it is
+// also elementwise over one contiguous float array, and at -O3 GCC vectorizes
+// the per-object loop too.  Both loops then run at about the same speed:
+// this checks that vec3_soa costs nothing over the per-object loop, not that
+// it beats it.
+void Bench(std::size_t n, int repeat) {
+
+    std::vector<vec3<float>> a(n), b(n), c(n);
+    vec3_soa<float> sa(n), sb(n), sc(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        b[i] = vec3<float>(i % 7, i % 11, i % 13);
+        c[i] = vec3<float>(1 + i % 3, 1 + i % 5, 1 + i % 2);
+        sb.set(i, {b[i][0], b[i][1], b[i][2]});
+        sc.set(i, {c[i][0], c[i][1], c[i][2]});
+    }
+
+    double aos = TimeUs(repeat, [&] {
+        for (std::size_t i = 0; i < n; ++i)
+            a[i] = b[i] + c[i] * (b[i] + 3 * c[i]);
+    });
+    double soa = TimeUs(repeat, [&] {
+        sa = sb + sc * (sb + 3 * sc);
+    });
+
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t k = 0; k < 3; ++k)
+            assert(sa[i][k] == a[i][k]);
+
+    printf("%zu vec3<float>: per-object loop %.1f us, vec3_soa %.1f us\n", n, aos, soa);
+}
+
+int main()
+{
+    vec3_soa<int> a(4), b(4), c(4);
+    for (std::size_t i = 0; i < 4; ++i) {
+        b.set(i, {int(i), -int(i), 2 * int(i)});
+        c.set(i, {1, 2, 3});
+    }
+
+    a = b + c;
+    for (std::size_t i = 0; i < a.size(); ++i)
+        std::cout << a[i] << std::endl;
+
+    // Single vec3s and scalars are broadcast across the batch.
+    vec3<int> offset(100, 200, 300);
+    a = 2 * b - offset;
+    for (std::size_t i = 0; i < a.size(); ++i)
+        std::cout << a[i] << std::endl;
+
+    // Cache-resident and memory-bound batch sizes.
+    Bench(1 << 12, 5000);
+    Bench(1 << 20, 20);
+
+    return 0;
+}
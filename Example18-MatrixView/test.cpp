@@ -0,0 +1,327 @@
+#include <boost/yap/yap.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace yap = boost::yap;
+
+// A dense row-major matrix.
+template <typename T>
+struct matrix {
+    std::size_t rows = 0;
+    std::size_t cols = 0;
+    std::vector<T> data;
+
+    matrix() = default;
+    matrix(std::size_t rows, std::size_t cols, T init = T()) : rows(rows), cols(cols), data(rows * cols, init) {}
+
+    T & operator() (std::size_t i, std::size_t j) { return data[i * cols + j]; }
+    T const & operator() (std::size_t i, std::size_t j) const { return data[i * cols + j]; }
+};
+
+// A read-only rows x cols window onto existing storage; element (i, j) lives
+// at data[i * rowStride + j * colStride].  Transposes, rows, columns and
+// sub-blocks of a matrix are all strided views.
+template <typename T>
+struct strided_view {
+    T const *data;
+    std::size_t rows;
+    std::size_t cols;
+    std::ptrdiff_t rowStride;
+    std::ptrdiff_t colStride;
+
+    T const & operator() (std::size_t i, std::size_t j) const { return data[i * rowStride + j * colStride]; }
+};
+
+template <typename T>
+strided_view<T> view(matrix<T> const &m) {
+    return {m.data.data(), m.rows, m.cols, std::ptrdiff_t(m.cols), 1};
+}
+
+template <typename T>
+strided_view<T> transpose(strided_view<T> const &v) {
+    return {v.data, v.cols, v.rows, v.colStride, v.rowStride};
+}
+
+template <typename T>
+strided_view<T> transpose(matrix<T> const &m) { return transpose(view(m)); }
+
+template <typename T>
+strided_view<T> block(strided_view<T> const &v, std::size_t i, std::size_t j, std::size_t rows, std::size_t cols) {
+    assert(i + rows <= v.rows && j + cols <= v.cols);
+    return {&v(i, j), rows, cols, v.rowStride, v.colStride};
+}
+
+template <typename T>
+strided_view<T> block(matrix<T> const &m, std::size_t i, std::size_t j, std::size_t rows, std::size_t cols) {
+    return block(view(m), i, j, rows, cols);
+}
+
+template <typename M>
+auto row(M const &m, std::size_t i) { return block(m, i, 0, 1, m.cols); }
+
+template <typename M>
+auto column(M const &m, std::size_t j) { return block(m, 0, j, m.rows, 1); }
+
+// Define a type trait that identifies the 2-D terminals.
+template <typename T>
+struct is_matrix : std::false_type {};
+
+template <typename T>
+struct is_matrix<matrix<T>> : std::true_type {};
+
+template <typename T>
+struct is_matrix<strided_view<T>> : std::true_type {};
+
+BOOST_YAP_USER_UDT_UNARY_OPERATOR(negate, yap::expression, is_matrix); // -
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(multiplies, yap::expression, is_matrix); // *
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(divides, yap::expression, is_matrix); // /
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(plus, yap::expression, is_matrix); // +
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(minus, yap::expression, is_matrix); // -
+
+// The 2-D counterpart of take_nth in vector.cpp: replaces every matrix or view
+// with its (i, j) element.
+struct take_ij {
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, matrix<T> const &m) {
+        T x = m(i, j);
+        return yap::make_terminal(std::move(x));
+    }
+
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, strided_view<T> const &v) {
+        T x = v(i, j);
+        return yap::make_terminal(std::move(x));
+    }
+
+    std::size_t i;
+    std::size_t j;
+};
+
+// Evaluates element (i, j) of an expression.
+template <typename Expr>
+auto at(Expr const &expr, std::size_t i, std::size_t j) {
+    return yap::evaluate(yap::transform(yap::as_expr(expr), take_ij{i, j}));
+}
+
+// Records whether all 2-D terminals of an expression have the given shape.
+struct equal_shapes_impl {
+    template <typename M, typename = std::enable_if_t<is_matrix<M>::value>>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, M const &m) {
+        if (m.rows != rows || m.cols != cols)
+            value = false;
+        return 0;
+    }
+
+    std::size_t const rows;
+    std::size_t const cols;
+    bool value;
+};
+
+// Records whether any view in an expression reads dst's storage.  Views may
+// read elements other than the one being written (e.g. A = transpose(A)), so
+// such an expression cannot be evaluated in place.  dst itself as a matrix
+// terminal is fine; it is only ever read at the element being written.
+template <typename T>
+struct aliases_impl {
+    template <typename U>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, strided_view<U> const &v) {
+        if (v.rows && v.cols) {
+            U const *first = v.data;
+            U const *last = v.data + (v.rows - 1) * v.rowStride + (v.cols - 1) * v.colStride;
+            if (std::max(first, last) >= begin && std::min(first, last) < end)
+                value = true;
+        }
+        return 0;
+    }
+
+    T const *begin;
+    T const *end;
+    bool value;
+};
+
+// Terminals after lowering: a row-major matrix keeps a unit column stride that
+// is known at compile time, so rows of it are read contiguously.
+template <typename T>
+struct dense_ref {
+    T const *data;
+    std::ptrdiff_t rowStride;
+};
+
+struct lower_views {
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, matrix<T> const &m) {
+        return yap::make_terminal(dense_ref<T>{m.data.data(), std::ptrdiff_t(m.cols)});
+    }
+
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, strided_view<T> const &v) {
+        return yap::make_terminal(strided_view<T>(v));
+    }
+};
+
+template <yap::expr_kind Kind, typename L, typename R>
+auto apply_op(L const &l, R const &r) {
+    if constexpr (Kind == yap::expr_kind::plus)
+        return l + r;
+    else if constexpr (Kind == yap::expr_kind::minus)
+        return l - r;
+    else if constexpr (Kind == yap::expr_kind::multiplies)
+        return l * r;
+    else if constexpr (Kind == yap::expr_kind::divides)
+        return l / r;
+    else
+        static_assert(Kind == yap::expr_kind::plus, "Unsupported operator in matrix expression");
+}
+
+// Fully evaluates element (i, j) of a lowered expression, without building an
+// intermediate tree per element.
+struct eval_ij {
+    template <typename T>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, dense_ref<T> const &m) const {
+        return m.data[i * m.rowStride + j];
+    }
+
+    template <typename T>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, strided_view<T> const &v) const {
+        return v(i, j);
+    }
+
+    template <typename T>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, T const &t) const {
+        return t;
+    }
+
+    template <typename Expr>
+    auto operator() (yap::expr_tag<yap::expr_kind::negate>, Expr &&expr) const {
+        return -yap::transform(yap::as_expr(expr), *this);
+    }
+
+    template <yap::expr_kind Kind, typename Expr1, typename Expr2>
+    auto operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) const {
+        return apply_op<Kind>(yap::transform(yap::as_expr(lhs), *this),
+                              yap::transform(yap::as_expr(rhs), *this));
+    }
+
+    std::size_t i;
+    std::size_t j;
+};
+
+// Tile edge used by assign() unless told otherwise: a 64 x 64 tile of doubles
+// is 32 KiB per operand, so a transposed operand's tile stays in L1/L2 while
+// its rows are walked.
+std::size_t const default_tile = 64;
+
+// Assigns some expression e to the given matrix by evaluating e elementwise,
+// one tile x tile block at a time.  Blocking keeps the cache lines of
+// transposed and otherwise strided operands alive until every element in them
+// has been used.  A tile of 0 evaluates row by row without blocking.
+template <typename T, typename Expr>
+matrix<T> & assign(matrix<T> &m, Expr const &e, std::size_t tile = default_tile) {
+    decltype(auto) expr = yap::as_expr(e);
+    equal_shapes_impl shapes{m.rows, m.cols, true};
+    yap::transform(expr, shapes);
+    assert(shapes.value && "matrix shapes in an expression must match");
+
+    aliases_impl<T> aliases{m.data.data(), m.data.data() + m.data.size(), false};
+    yap::transform(expr, aliases);
+    if (aliases.value) {
+        matrix<T> tmp(m.rows, m.cols);
+        assign(tmp, expr, tile);
+        m = std::move(tmp);
+        return m;
+    }
+
+    auto lowered = yap::transform(expr, lower_views{});
+    std::size_t const rowTile = tile ? tile : m.rows;
+    std::size_t const colTile = tile ? tile : m.cols;
+    for (std::size_t ii = 0; ii < m.rows; ii += rowTile) {
+        std::size_t const iEnd = std::min(ii + rowTile, m.rows);
+        for (std::size_t jj = 0; jj < m.cols; jj += colTile) {
+            std::size_t const jEnd = std::min(jj + colTile, m.cols);
+            for (std::size_t i = ii; i < iEnd; ++i) {
+                T *out = &m(i, jj);
+                // Elements of m are only read at the index being written.
+#pragma GCC ivdep
+                for (std::size_t j = jj; j < jEnd; ++j)
+                    out[j - jj] = static_cast<T>(yap::transform(lowered, eval_ij{i, j}));
+            }
+        }
+    }
+    return m;
+}
+
+template <typename T>
+void print(matrix<T> const &m) {
+    for (std::size_t i = 0; i < m.rows; ++i) {
+        for (std::size_t j = 0; j < m.cols; ++j)
+            std::cout << (j ? " " : "") << m(i, j);
+        std::cout << std::endl;
+    }
+}
+
+template <typename Fn>
+double TimeMs(int repeat, Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+        fn();
+        // Keep the compiler from merging the repetitions.
+        asm volatile("" ::: "memory");
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / repeat;
+}
+
+void Bench(std::size_t n) {
+    matrix<double> A(n, n), B(n, n), C(n, n), ref(n, n);
+    for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t j = 0; j < n; ++j) {
+            A(i, j) = double(i * n + j);
+            B(i, j) = double(i) - double(j);
+        }
+    }
+
+    int const repeat = 5;
+    double naive = TimeMs(repeat, [&] { assign(ref, A + transpose(B), 0); });
+    printf("%zu x %zu A + transpose(B): untiled %.2f ms", n, n, naive);
+    for (std::size_t tile : {16, 32, 64, 128}) {
+        double t = TimeMs(repeat, [&] { assign(C, A + transpose(B), tile); });
+        assert(C.data == ref.data);
+        printf(", tile %zu %.2f ms", tile, t);
+    }
+    printf("\n");
+}
+
+int main() {
+    matrix<int> A(3, 4), B(4, 3), C(3, 4);
+    for (std::size_t i = 0; i < 3; ++i) {
+        for (std::size_t j = 0; j < 4; ++j) {
+            A(i, j) = int(i * 4 + j);
+            B(j, i) = int(100 * j + i);
+        }
+    }
+
+    assign(C, A + transpose(B));
+    print(C);
+
+    std::cout << "at(2 * A - 1, 1, 2) = " << at(2 * A - 1, 1, 2) << std::endl;
+
+    // Columns and rows are views too; here a column of A plus a column of B^T.
+    matrix<int> col(3, 1);
+    assign(col, column(A, 0) + column(transpose(B), 3));
+    print(col);
+
+    matrix<int> sq(3, 3);
+    assign(sq, block(A, 0, 1, 3, 3));
+    // Reading the transpose of the destination goes through a temporary.
+    assign(sq, sq + transpose(sq));
+    print(sq);
+
+    Bench(2048);
+    Bench(4096);
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+#include <boost/yap/yap.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Set to 0 to compile the labelled assign() down to the plain one.
+#ifndef ASSIGN_PROFILING
+#define ASSIGN_PROFILING 1
+#endif
+
+namespace yap = boost::yap;
+
+struct take_nth
+{
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>,
+                     std::vector<T> const & vec)
+    { return yap::make_terminal(vec[n]); }
+
+    std::size_t n;
+};
+
+// A stateful transform that records whether all the std::vector<> terminals
+// it has seen are equal to the given size.
+struct equal_sizes_impl
+{
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>,
+                     std::vector<T> const & vec)
+    {
+        auto const expr_size = vec.size();
+        if (expr_size != size)
+            value = false;
+        return 0;
+    }
+
+    std::size_t const size;
+    bool value;
+};
+
+template <typename Expr>
+bool equal_sizes (std::size_t size, Expr const & expr)
+{
+    equal_sizes_impl impl{size, true};
+    yap::transform(yap::as_expr(expr), impl);
+    return impl.value;
+}
+
+// Define a type trait that identifies std::vectors.
+template <typename T>
+struct is_vector : std::false_type {};
+
+template <typename T, typename A>
+struct is_vector<std::vector<T, A>> : std::true_type {};
+
+// Assigns some expression e to the given vector by evaluating e elementwise,
+// to avoid temporaries and allocations.
+template <typename T, typename Expr>
+std::vector<T> & assign (std::vector<T> & vec, Expr const & e)
+{
+    decltype(auto) expr = yap::as_expr(e);
+    assert(equal_sizes(vec.size(), expr));
+    for (std::size_t i = 0, size = vec.size(); i < size; ++i) {
+        vec[i] = yap::evaluate(
+            yap::transform(yap::as_expr(expr), take_nth{i}));
+    }
+    return vec;
+}
+
+// Per-element cost of an expression: how many vector and scalar terminals it
+// reads, how many bytes those vectors contribute, and how many operators are
+// applied.  A vector that appears more than once is only read from memory
+// once, so its bytes are counted once.  Both branches of if_else() are
+// charged, although only one of them is read per element.
+struct expr_cost_impl
+{
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T && t)
+    {
+        using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+        if constexpr (is_vector<value_type>::value) {
+            ++vectors;
+            void const * data = t.data();
+            if (std::find(seen.begin(), seen.end(), data) == seen.end()) {
+                seen.push_back(data);
+                bytes += sizeof(typename value_type::value_type);
+            }
+        } else {
+            ++scalars;
+        }
+        return 0;
+    }
+
+    template <yap::expr_kind Kind, typename ...Args>
+    auto operator() (yap::expr_tag<Kind>, Args && ...args)
+    {
+        ++ops;
+        (yap::transform(yap::as_expr(args), *this), ...);
+        return 0;
+    }
+
+    std::size_t vectors = 0;
+    std::size_t scalars = 0;
+    std::size_t bytes = 0;
+    std::size_t ops = 0;
+    std::vector<void const *> seen;
+};
+
+// Accumulated measurements of one assign() call site.
+struct assign_stats
+{
+    std::size_t calls = 0;
+    std::size_t elements = 0;
+    std::size_t vectors = 0;
+    std::size_t scalars = 0;
+    double bytes = 0;
+    double ops = 0;
+    double seconds = 0;
+};
+
+std::map<std::string, assign_stats> & assign_profile ()
+{
+    static std::map<std::string, assign_stats> profile;
+    return profile;
+}
+
+// As assign() above, but when ASSIGN_PROFILING is on, the expression is walked
+// to count its terminals, bytes and operators, and the loop is timed.  The
+// results accumulate under label; see report_assign_profile().
+template <typename T, typename Expr>
+std::vector<T> & assign (std::vector<T> & vec, Expr const & e, char const * label)
+{
+    if constexpr (!ASSIGN_PROFILING) {
+        return assign(vec, e);
+    } else {
+        expr_cost_impl cost;
+        yap::transform(yap::as_expr(e), cost);
+
+        auto const start = std::chrono::steady_clock::now();
+        assign(vec, e);
+        auto const end = std::chrono::steady_clock::now();
+
+        assign_stats & stats = assign_profile()[label];
+        std::size_t const n = vec.size();
+        stats.calls += 1;
+        stats.elements += n;
+        stats.vectors = cost.vectors;
+        stats.scalars = cost.scalars;
+        stats.bytes += double(n) * (cost.bytes + sizeof(T));
+        stats.ops += double(n) * cost.ops;
+        stats.seconds += std::chrono::duration<double>(end - start).count();
+        return vec;
+    }
+}
+
+// Labels the assignment with its source location.
+#define ASSIGN(vec, expr) assign(vec, expr, __FILE__ ":" BOOST_PP_STRINGIZE(__LINE__))
+
+// Machine peaks the measurements are compared against.  Both can be given
+// through the PEAK_GBS and PEAK_GFLOPS environment variables; otherwise they
+// are measured once with STREAM-style copy/triad loops and an in-register
+// multiply-add loop.
+struct machine_peak
+{
+    double gbs;
+    double gflops;
+};
+
+double measure_peak_gbs ()
+{
+    std::size_t const n = 1 << 24;
+    std::vector<double> a(n), b(n, 1.0), c(n, 2.0), d(n, 3.0);
+    double best = 0;
+    auto run = [&](std::size_t streams, auto && kernel) {
+        for (int r = 0; r < 5; ++r) {
+            auto const start = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < n; ++i)
+                kernel(i);
+            auto const end = std::chrono::steady_clock::now();
+            asm volatile("" ::: "memory");
+            best = std::max(best, streams * n * sizeof(double) / std::chrono::duration<double>(end - start).count());
+        }
+    };
+    run(2, [&](std::size_t i) { a[i] = b[i]; });
+    run(3, [&](std::size_t i) { a[i] = b[i] + 3.0 * c[i]; });
+    run(4, [&](std::size_t i) { a[i] = b[i] + c[i] * d[i]; });
+    return best / 1e9;
+}
+
+double measure_peak_gflops ()
+{
+    // Enough independent chains to cover the multiply-add latency.
+    int const accumulators = 64;
+    std::size_t const iterations = 1 << 21;
+    double acc[accumulators];
+    for (int k = 0; k < accumulators; ++k)
+        acc[k] = k;
+    double const x = 0.999999, y = 1e-7;
+    auto const start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        for (int k = 0; k < accumulators; ++k)
+            acc[k] = acc[k] * x + y;
+    }
+    auto const end = std::chrono::steady_clock::now();
+    double sum = 0;
+    for (int k = 0; k < accumulators; ++k)
+        sum += acc[k];
+    asm volatile("" : : "r"(sum));
+    double const flops = 2.0 * accumulators * iterations;
+    return flops / std::chrono::duration<double>(end - start).count() / 1e9;
+}
+
+machine_peak const & get_machine_peak ()
+{
+    static machine_peak const peak = [] {
+        char const * gbs = std::getenv("PEAK_GBS");
+        char const * gflops = std::getenv("PEAK_GFLOPS");
+        return machine_peak{gbs ? std::atof(gbs) : measure_peak_gbs(),
+                            gflops ? std::atof(gflops) : measure_peak_gflops()};
+    }();
+    return peak;
+}
+
+// Prints one line per call site.  An expression whose operators-per-byte is
+// below the machine balance (peak GFLOP/s over peak GB/s) cannot reach the
+// compute peak and is reported as bandwidth-bound.
+void report_assign_profile (std::ostream & os)
+{
+    machine_peak const & peak = get_machine_peak();
+    double const balance = peak.gflops / peak.gbs;
+    os << "assign() profile (peak " << peak.gbs << " GB/s, " << peak.gflops << " GFLOP/s)\n";
+    for (auto const & [label, s] : assign_profile()) {
+        double const gbs = s.bytes / s.seconds / 1e9;
+        double const gflops = s.ops / s.seconds / 1e9;
+        double const intensity = s.ops / s.bytes;
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "  %-24s calls %3zu  terms %zu+%zu  ops/B %.3f  %8.3f ms  %7.2f GB/s (%5.1f%%)  %7.3f GFLOP/s (%5.1f%%)  %s\n",
+                 label.c_str(), s.calls, s.vectors, s.scalars, intensity, s.seconds * 1e3,
+                 gbs, 100 * gbs / peak.gbs, gflops, 100 * gflops / peak.gflops,
+                 intensity < balance ? "bandwidth-bound" : "compute-bound");
+        os << line;
+    }
+}
+
+// Define all the expression-returning numeric operators we need.  Each will
+// accept any std::vector<> as any of its arguments, and then any value in the
+// remaining argument, if any -- some of the operators below are unary.
+BOOST_YAP_USER_UDT_UNARY_OPERATOR(negate, yap::expression, is_vector); // -
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(multiplies, yap::expression, is_vector); // *
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(divides, yap::expression, is_vector); // /
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(modulus, yap::expression, is_vector); // %
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(plus, yap::expression, is_vector); // +
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(minus, yap::expression, is_vector); // -
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(less, yap::expression, is_vector); // <
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(greater, yap::expression, is_vector); // >
+
+int main()
+{
+    std::size_t const n = 1 << 22;
+    std::vector<double> a(n), b(n), c(n), d(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        a[i] = double(i);
+        b[i] = 2.0 * i;
+        c[i] = 3.0 * i;
+    }
+
+    for (int r = 0; r < 4; ++r) {
+        ASSIGN(d, a + b * c);
+        ASSIGN(d, a);
+        ASSIGN(d, a * a * a * a * a * a * a * a + 1.0);
+        assign(d, if_else(a < 30, b, c), "select");
+    }
+
+    report_assign_profile(std::cout);
+
+    return 0;
+}
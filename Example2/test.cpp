@@ -4,6 +4,8 @@
 #include <iostream>
 #include <cmath>
 
+#include "../trace.hpp"
+
 namespace yap = boost::yap;
 namespace hana = boost::hana;
 
@@ -114,11 +116,11 @@ struct NumberExpr :
     }
 };
 
+template <typename Trace = DefaultTrace>
 struct Transformer {
     auto operator() (const Number &n) {
-        printf("Terminal1 matched\n");
+        Trace::Record("Terminal1 matched");
         double value = yap::value(n).x;
-        yap::value(n).Println();
         return NumberExpr{Number(value + 10.0)};
     }
 
@@ -126,7 +128,7 @@ struct Transformer {
     auto operator() (NumberExprT<
                         yap::expr_kind::plus,
                         boost::hana::tuple<Expr1, Expr2> > const &plus_expr) {
-        printf("plus_expr matched\n");
+        Trace::Record("plus_expr matched");
         // yap::print(std::cout, yap::left(plus_expr));
         // yap::print(std::cout, yap::right(plus_expr));
         return yap::transform(yap::left(plus_expr), *this) +
@@ -137,25 +139,17 @@ struct Transformer {
     auto operator() (NumberExprT<
                         yap::expr_kind::multiplies,
                         boost::hana::tuple<Expr1, Expr2> > const &mult_expr) {
-        printf("multiplies_expr matched\n");
-        printf("left: ");
-        PrintTypeName(yap::left(mult_expr));
-        yap::print(std::cout, yap::left(mult_expr));
-        auto x = yap::deref(yap::left(mult_expr));
-        printf("left deref: ");
-        PrintTypeName(x);
-        printf("right: ");
-        PrintTypeName(yap::right(mult_expr));
-        yap::print(std::cout, yap::right(mult_expr));
+        Trace::Record("multiplies_expr matched");
+        Trace::Record("left:", TypeName<decltype(yap::left(mult_expr))>());
+        Trace::Record("left deref:", TypeName<decltype(yap::deref(yap::left(mult_expr)))>());
+        Trace::Record("right:", TypeName<decltype(yap::right(mult_expr))>());
         return yap::transform(yap::deref(yap::left(mult_expr)), *this) *
                yap::transform(yap::deref(yap::right(mult_expr)), *this);
     }
 
     template <typename Expr>
     auto operator() (Expr const &expr) {
-        printf("Should not reach here\n");
-        PrintTypeName(expr);
-        yap::print(std::cout, expr);
+        Trace::Record("Should not reach here", TypeName<Expr>());
         return expr;
     }
 };
@@ -174,7 +168,8 @@ void TestNumberExpr3() {
     std::cout << "- Before transformation:\n";
     yap::print(std::cout, expr1);
 
-    auto expr2 = yap::transform(expr1, Transformer{});
+    auto expr2 = yap::transform(expr1, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
 
     std::cout << "- After transformation:\n";
     yap::print(std::cout, expr2);
@@ -0,0 +1,289 @@
+#include <boost/yap/yap.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace yap = boost::yap;
+
+void Check(bool ok, char const *what) {
+    if (!ok) {
+        perror(what);
+        std::exit(1);
+    }
+}
+
+// A file of doubles mapped into memory.  Pages are only brought in when they
+// are touched, so the array can be much larger than RAM.
+class mapped_array {
+public:
+    // Maps an existing file read-only.
+    static mapped_array open(std::string const &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        Check(fd >= 0, path.c_str());
+        struct stat st;
+        Check(fstat(fd, &st) == 0, "fstat");
+        return mapped_array(fd, st.st_size / sizeof(double), false);
+    }
+
+    // Creates (or truncates) a file of n doubles and maps it read-write.
+    static mapped_array create(std::string const &path, std::size_t n) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        Check(fd >= 0, path.c_str());
+        Check(ftruncate(fd, n * sizeof(double)) == 0, "ftruncate");
+        return mapped_array(fd, n, true);
+    }
+
+    mapped_array(mapped_array &&other) : mFd(other.mFd), mData(other.mData), mSize(other.mSize), mWritable(other.mWritable) {
+        other.mFd = -1;
+        other.mData = nullptr;
+        other.mSize = 0;
+    }
+
+    mapped_array(mapped_array const &) = delete;
+    mapped_array & operator= (mapped_array const &) = delete;
+
+    ~mapped_array() {
+        if (mData)
+            munmap(mData, bytes());
+        if (mFd >= 0)
+            close(mFd);
+    }
+
+    std::size_t size() const { return mSize; }
+    std::size_t bytes() const { return mSize * sizeof(double); }
+    bool writable() const { return mWritable; }
+
+    double const * data() const { return mData; }
+    double * data() { assert(mWritable); return mData; }
+
+    double operator[] (std::size_t i) const { return mData[i]; }
+
+    // Starts asynchronous read-ahead of elements [first, last).
+    void WillNeed(std::size_t first, std::size_t last) const { Advise(first, last, MADV_WILLNEED); }
+
+    // Drops elements [first, last) from this process's resident set, after
+    // starting write-back if they may be dirty.  The data stays in the file.
+    void DontNeed(std::size_t first, std::size_t last) const {
+        if (first >= last)
+            return;
+        if (mWritable)
+            msync(PageBegin(first), PageEnd(last) - PageBegin(first), MS_ASYNC);
+        Advise(first, last, MADV_DONTNEED);
+    }
+
+private:
+    mapped_array(int fd, std::size_t n, bool writable) : mFd(fd), mSize(n), mWritable(writable) {
+        void *p = mmap(nullptr, std::max<std::size_t>(bytes(), 1),
+                       writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        Check(p != MAP_FAILED, "mmap");
+        mData = static_cast<double *>(p);
+        // The whole array is read front to back.
+        madvise(mData, bytes(), MADV_SEQUENTIAL);
+    }
+
+    char * PageBegin(std::size_t i) const {
+        std::uintptr_t const page = sysconf(_SC_PAGESIZE);
+        return reinterpret_cast<char *>(reinterpret_cast<std::uintptr_t>(mData + i) / page * page);
+    }
+
+    char * PageEnd(std::size_t i) const {
+        std::uintptr_t const page = sysconf(_SC_PAGESIZE);
+        return reinterpret_cast<char *>((reinterpret_cast<std::uintptr_t>(mData + i) + page - 1) / page * page);
+    }
+
+    void Advise(std::size_t first, std::size_t last, int advice) const {
+        last = std::min(last, mSize);
+        if (first < last)
+            madvise(PageBegin(first), PageEnd(last) - PageBegin(first), advice);
+    }
+
+    int mFd = -1;
+    double *mData = nullptr;
+    std::size_t mSize = 0;
+    bool mWritable = false;
+};
+
+// Define a type trait that identifies mapped arrays.
+template <typename T>
+struct is_mapped : std::false_type {};
+
+template <>
+struct is_mapped<mapped_array> : std::true_type {};
+
+BOOST_YAP_USER_UDT_UNARY_OPERATOR(negate, yap::expression, is_mapped); // -
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(multiplies, yap::expression, is_mapped); // *
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(divides, yap::expression, is_mapped); // /
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(plus, yap::expression, is_mapped); // +
+BOOST_YAP_USER_UDT_ANY_BINARY_OPERATOR(minus, yap::expression, is_mapped); // -
+
+// Collects the distinct mapped arrays an expression reads.
+struct collect_mappings {
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, mapped_array const &m) {
+        if (std::find(arrays.begin(), arrays.end(), &m) == arrays.end())
+            arrays.push_back(&m);
+        return 0;
+    }
+
+    std::vector<mapped_array const *> arrays;
+};
+
+// Replaces every mapped array with a pointer to the first element of the
+// current block.
+struct take_block {
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, mapped_array const &m) {
+        double const *p = m.data() + first;
+        return yap::make_terminal(std::move(p));
+    }
+
+    std::size_t first;
+};
+
+template <yap::expr_kind Kind, typename L, typename R>
+auto ApplyOp(L const &l, R const &r) {
+    if constexpr (Kind == yap::expr_kind::plus)
+        return l + r;
+    else if constexpr (Kind == yap::expr_kind::minus)
+        return l - r;
+    else if constexpr (Kind == yap::expr_kind::multiplies)
+        return l * r;
+    else if constexpr (Kind == yap::expr_kind::divides)
+        return l / r;
+    else
+        static_assert(Kind == yap::expr_kind::plus, "Unsupported operator in mapped_array expression");
+}
+
+// Evaluates element i of a block-lowered expression.
+struct EvalAt {
+    double operator() (yap::expr_tag<yap::expr_kind::terminal>, double const *p) const {
+        return p[i];
+    }
+
+    template <typename T>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, T const &t) const {
+        return t;
+    }
+
+    template <typename Expr>
+    auto operator() (yap::expr_tag<yap::expr_kind::negate>, Expr &&expr) const {
+        return -yap::transform(yap::as_expr(expr), *this);
+    }
+
+    template <yap::expr_kind Kind, typename Expr1, typename Expr2>
+    auto operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) const {
+        return ApplyOp<Kind>(yap::transform(yap::as_expr(lhs), *this),
+                             yap::transform(yap::as_expr(rhs), *this));
+    }
+
+    std::size_t i;
+};
+
+// Default block: 4 MiB of doubles per array.
+std::size_t const default_block = std::size_t(1) << 19;
+
+// Assigns e to out one block of elements at a time.  While block k is
+// computed, block k + 1 of every input is being read ahead; once block k is
+// written it is dropped from the resident set of every array, so resident
+// memory stays around two blocks per array no matter how large the files are.
+template <typename Expr>
+mapped_array & assign(mapped_array &out, Expr const &e, std::size_t block = default_block) {
+    decltype(auto) expr = yap::as_expr(e);
+    collect_mappings mappings;
+    yap::transform(expr, mappings);
+    for (mapped_array const *m : mappings.arrays)
+        assert(m->size() == out.size() && "mapped arrays in an expression must have the same size");
+    mappings.arrays.push_back(&out);
+
+    // Keep block boundaries on page boundaries so that advice never touches
+    // the neighbouring block.
+    std::size_t const pageElems = sysconf(_SC_PAGESIZE) / sizeof(double);
+    block = std::max(pageElems, block / pageElems * pageElems);
+
+    std::size_t const n = out.size();
+    for (mapped_array const *m : mappings.arrays)
+        m->WillNeed(0, block);
+    for (std::size_t first = 0; first < n; first += block) {
+        std::size_t const last = std::min(first + block, n);
+        for (mapped_array const *m : mappings.arrays)
+            m->WillNeed(last, last + block);
+
+        auto lowered = yap::transform(expr, take_block{first});
+        double *dst = out.data() + first;
+        // out may also be an input, but only at the index being written.
+#pragma GCC ivdep
+        for (std::size_t i = 0; i < last - first; ++i)
+            dst[i] = yap::transform(lowered, EvalAt{i});
+
+        for (mapped_array const *m : mappings.arrays)
+            m->DontNeed(first, last);
+    }
+    return out;
+}
+
+// Writes n doubles f(0), f(1), ... to path with plain write() calls, so that
+// creating the inputs does not inflate this process's resident set.
+template <typename Fn>
+void WriteFile(std::string const &path, std::size_t n, Fn &&f) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    Check(fd >= 0, path.c_str());
+    std::vector<double> buf(1 << 16);
+    for (std::size_t first = 0; first < n; first += buf.size()) {
+        std::size_t const count = std::min(buf.size(), n - first);
+        for (std::size_t i = 0; i < count; ++i)
+            buf[i] = f(first + i);
+        Check(write(fd, buf.data(), count * sizeof(double)) == ssize_t(count * sizeof(double)), "write");
+    }
+    close(fd);
+}
+
+long MaxRssMiB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+}
+
+int main(int argc, char *argv[]) {
+    std::string const dir = argc > 1 ? argv[1] : "/tmp";
+    std::size_t const n = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::size_t(1) << 24;
+
+    WriteFile(dir + "/yap_a.bin", n, [](std::size_t i) { return double(i % 1000); });
+    WriteFile(dir + "/yap_b.bin", n, [](std::size_t) { return 0.5; });
+    WriteFile(dir + "/yap_c.bin", n, [](std::size_t i) { return double(i % 7); });
+    long const rssBefore = MaxRssMiB();
+
+    {
+        mapped_array a = mapped_array::open(dir + "/yap_a.bin");
+        mapped_array b = mapped_array::open(dir + "/yap_b.bin");
+        mapped_array c = mapped_array::open(dir + "/yap_c.bin");
+        mapped_array out = mapped_array::create(dir + "/yap_out.bin", n);
+
+        auto start = std::chrono::steady_clock::now();
+        assign(out, a * b + c);
+        auto end = std::chrono::steady_clock::now();
+        double const seconds = std::chrono::duration<double>(end - start).count();
+
+        for (std::size_t i : {std::size_t(0), n / 3, n - 1})
+            assert(out[i] == a[i] * b[i] + c[i]);
+        out.DontNeed(0, n);
+
+        printf("out = a * b + c over %zu doubles (%zu MiB per file): %.1f ms, %.2f GB/s\n",
+               n, n * sizeof(double) >> 20, seconds * 1e3, 4.0 * n * sizeof(double) / seconds / 1e9);
+        printf("max resident set: %ld MiB before, %ld MiB after (inputs and output total %zu MiB)\n",
+               rssBefore, MaxRssMiB(), 4 * n * sizeof(double) >> 20);
+    }
+
+    for (char const *name : {"/yap_a.bin", "/yap_b.bin", "/yap_c.bin", "/yap_out.bin"})
+        unlink((dir + name).c_str());
+    return 0;
+}
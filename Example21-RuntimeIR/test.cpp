@@ -0,0 +1,1648 @@
+#include <boost/yap/expression.hpp>
+#include <boost/yap/print.hpp>
+#include <cassert>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+namespace yap = boost::yap;
+
+using Element = float;
+using Shape = std::vector<std::size_t>;
+
+// Tensor buffers are aligned for the widest vector loads/stores.
+constexpr std::size_t kAlignment = 64;
+
+std::size_t NumElements(const Shape &shape) {
+    std::size_t n = 1;
+    for (auto d : shape)
+        n *= d;
+    return n;
+}
+
+std::ostream& operator<< (std::ostream &os, const Shape &shape) {
+    os << "[";
+    for (std::size_t i = 0; i < shape.size(); ++i)
+        os << (i ? "x" : "") << shape[i];
+    return os << "]";
+}
+
+// The tensor of Example14: an aligned buffer shared by all copies.  A tensor
+// with an empty shape holds a single element and is broadcast by the kernels.
+struct Tensor {
+    int id;
+    Shape shape;
+    std::shared_ptr<Element> buffer;
+
+    Tensor(int id, const Shape &shape) : id(id), shape(shape) {
+        std::size_t bytes = (NumElements(shape) * sizeof(Element) + kAlignment - 1) / kAlignment * kAlignment;
+        // A shape with a zero dimension has no elements and gets no buffer.
+        if (bytes != 0)
+            buffer.reset(static_cast<Element *>(std::aligned_alloc(kAlignment, bytes)), std::free);
+    }
+
+    std::size_t size() const { return NumElements(shape); }
+    Element *data() const { return buffer.get(); }
+
+    void Fill(Element value) const { std::fill(data(), data() + size(), value); }
+
+    friend std::ostream& operator<< (std::ostream &os, const Tensor &t) {
+        os << "tensor" << t.id << t.shape << "{";
+        if (t.size() > 0)
+            os << t.data()[0];
+        if (t.size() > 1)
+            os << ", ..., " << t.data()[t.size() - 1];
+        os << "}";
+        return os;
+    }
+};
+
+auto MakeTensor(int id, const Shape &shape) {
+    return Tensor{id, shape};
+}
+
+// An input of an elementwise kernel: either a whole tensor or a scalar that is
+// broadcast.  Rank 0 tensors (e.g. call results) are read as scalars.
+struct Operand {
+    const Element *data;
+    Element scalar;
+};
+
+Operand MakeOperand(const Tensor &t) {
+    if (t.shape.empty())
+        return Operand{nullptr, t.data()[0]};
+    return Operand{t.data(), 0};
+}
+
+// The operand for elements [first, ...) of op.
+Operand Offset(Operand op, std::size_t first) {
+    return op.data ? Operand{op.data + first, 0} : op;
+}
+
+// Computes out[i] = op(lhs[i], rhs[i]) for i < n.  Each combination of tensor
+// and scalar operands gets its own loop so that every one of them is
+// vectorized.  out may be one of the inputs, but only at the index being
+// written.  All pointers must be kAlignment aligned.
+template <typename Op>
+void Elementwise(Element *out, std::size_t n, Operand lhs, Operand rhs, Op op) {
+    auto *dst = static_cast<Element *>(__builtin_assume_aligned(out, kAlignment));
+    if (lhs.data && rhs.data) {
+        auto *x = static_cast<const Element *>(__builtin_assume_aligned(lhs.data, kAlignment));
+        auto *y = static_cast<const Element *>(__builtin_assume_aligned(rhs.data, kAlignment));
+#pragma GCC ivdep
+        for (std::size_t i = 0; i < n; ++i)
+            dst[i] = op(x[i], y[i]);
+    } else if (lhs.data) {
+        auto *x = static_cast<const Element *>(__builtin_assume_aligned(lhs.data, kAlignment));
+        Element y = rhs.scalar;
+#pragma GCC ivdep
+        for (std::size_t i = 0; i < n; ++i)
+            dst[i] = op(x[i], y);
+    } else if (rhs.data) {
+        Element x = lhs.scalar;
+        auto *y = static_cast<const Element *>(__builtin_assume_aligned(rhs.data, kAlignment));
+#pragma GCC ivdep
+        for (std::size_t i = 0; i < n; ++i)
+            dst[i] = op(x, y[i]);
+    } else {
+        std::fill(dst, dst + n, op(lhs.scalar, rhs.scalar));
+    }
+}
+
+void TensorAdd(const Tensor &out, Operand lhs, Operand rhs) {
+    Elementwise(out.data(), out.size(), lhs, rhs, [](Element x, Element y) { return x + y; });
+}
+
+void TensorMul(const Tensor &out, Operand lhs, Operand rhs) {
+    Elementwise(out.data(), out.size(), lhs, rhs, [](Element x, Element y) { return x * y; });
+}
+
+// The runtime IR.  Unlike GenIR's hana::tuple, whose type grows with every
+// appended IR, a program is a plain vector of fixed-size instructions, so
+// lowering costs one template instantiation per expression node and passes
+// are ordinary loops.
+
+enum class Opcode : std::uint8_t { Add, Mul, Call, Fused, CopyIn, CopyOut };
+
+// Where an instruction operand lives: Program::mInputs, the temps, or
+// Program::mConstants.
+enum class ArgKind : std::uint8_t { Input, Temp, Constant };
+
+struct Arg {
+    ArgKind kind;
+    std::uint32_t index;
+};
+
+// temp[dest] = op(src[0], src[1]).  A Call has no operands; it stores the
+// result of Program::mCalls[callee] in a rank 0 temp.  A Fused instruction
+// runs Program::mKernels[kernel].  In a staged program (see StageTiles) CopyIn
+// copies the current tile of input src[0] into temp dest, and CopyOut copies
+// temp src[0] into the current tile of Program::mOutputs[dest].
+struct Instr {
+    Opcode op;
+    std::uint32_t dest;
+    union {
+        Arg src[2];
+        std::uint32_t callee;
+        std::uint32_t kernel;
+    };
+};
+
+// An operand of a micro-op: a register of the fused kernel, or one of the
+// kernel's arguments.
+struct Slot {
+    bool reg;
+    std::uint32_t index;
+};
+
+// Micro-op i of a fused kernel writes register i.
+struct MicroOp {
+    Opcode op;
+    Slot src[2];
+};
+
+// A chain of elementwise instructions run as one kernel.  The intermediates
+// live in registers that only hold one strip of elements at a time; the last
+// micro-op writes the kernel's dest.
+struct FusedKernel {
+    std::vector<Arg> mArgs;
+    std::vector<MicroOp> mOps;
+};
+
+struct Program {
+    std::vector<Instr> mCode;
+    std::vector<Tensor> mInputs;
+    std::vector<Element> mConstants;
+    std::vector<std::function<Element()>> mCalls;
+    std::vector<FusedKernel> mKernels;
+    std::vector<Tensor> mOutputs;    // Only used by staged programs
+    std::vector<Shape> mTempShapes;  // Indexed by temp
+
+    std::uint32_t NumTemps() const { return mTempShapes.size(); }
+
+    // The temp holding the value of the whole expression
+    std::uint32_t Result() const { return mCode.back().dest; }
+};
+
+std::ostream& operator<< (std::ostream &os, Arg arg) {
+    switch (arg.kind) {
+        case ArgKind::Input:
+            return os << "in" << arg.index;
+        case ArgKind::Temp:
+            return os << "t" << arg.index;
+        default:
+            return os << "c" << arg.index;
+    }
+}
+
+void PrintProgram(const Program &program) {
+    printf("Program: %zu instructions, %u temps\n", program.mCode.size(), program.NumTemps());
+    for (std::size_t i = 0; i < program.mInputs.size(); ++i)
+        std::cout << "    in" << i << " = " << program.mInputs[i] << std::endl;
+    for (std::size_t i = 0; i < program.mConstants.size(); ++i)
+        std::cout << "    c" << i << " = " << program.mConstants[i] << std::endl;
+    for (auto const &instr : program.mCode) {
+        if (instr.op == Opcode::CopyOut) {
+            std::cout << "    out" << instr.dest << " = CopyTo<GM>(" << instr.src[0] << ")" << std::endl;
+            continue;
+        }
+        std::cout << "    t" << instr.dest << program.mTempShapes[instr.dest] << " = ";
+        switch (instr.op) {
+            case Opcode::Add:
+                std::cout << "add " << instr.src[0] << ", " << instr.src[1];
+                break;
+            case Opcode::Mul:
+                std::cout << "mul " << instr.src[0] << ", " << instr.src[1];
+                break;
+            case Opcode::Call:
+                std::cout << "call f" << instr.callee;
+                break;
+            case Opcode::Fused: {
+                std::cout << "fused k" << instr.kernel << "(";
+                auto const &args = program.mKernels[instr.kernel].mArgs;
+                for (std::size_t i = 0; i < args.size(); ++i)
+                    std::cout << (i ? ", " : "") << args[i];
+                std::cout << ")";
+                break;
+            }
+            case Opcode::CopyIn:
+                std::cout << "CopyTo<UBUF>(" << instr.src[0] << ")";
+                break;
+            default:
+                break;
+        }
+        std::cout << std::endl;
+    }
+    for (std::size_t k = 0; k < program.mKernels.size(); ++k) {
+        std::cout << "    k" << k << ":";
+        auto const &ops = program.mKernels[k].mOps;
+        for (std::size_t i = 0; i < ops.size(); ++i) {
+            std::cout << (i ? "; r" : " r") << i << " = " << (ops[i].op == Opcode::Add ? "add" : "mul");
+            for (int j = 0; j < 2; ++j)
+                std::cout << (j ? ", " : " ") << (ops[i].src[j].reg ? "r" : "a") << ops[i].src[j].index;
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Lowers an expression into a Program, emitting instructions in the same
+// order as GenIR (left operand, right operand, then the op itself), and
+// returns the Arg holding the value of each subexpression.
+struct LowerXform {
+    Program &mProgram;
+
+    Shape ShapeOf(Arg arg) const {
+        switch (arg.kind) {
+            case ArgKind::Input:
+                return mProgram.mInputs[arg.index].shape;
+            case ArgKind::Temp:
+                return mProgram.mTempShapes[arg.index];
+            default:
+                return {};
+        }
+    }
+
+    Arg NewTemp(const Shape &shape) {
+        mProgram.mTempShapes.push_back(shape);
+        return Arg{ArgKind::Temp, mProgram.NumTemps() - 1};
+    }
+
+    Arg operator() (yap::expr_tag<yap::expr_kind::terminal>, const Tensor &t) {
+        // The same tensor used twice is one input
+        auto &inputs = mProgram.mInputs;
+        auto it = std::find_if(inputs.begin(), inputs.end(), [&t](const Tensor &in) { return in.data() == t.data(); });
+        if (it == inputs.end())
+            it = inputs.insert(inputs.end(), t);
+        return Arg{ArgKind::Input, std::uint32_t(it - inputs.begin())};
+    }
+
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic<std::decay_t<T>>::value>>
+    Arg operator() (yap::expr_tag<yap::expr_kind::terminal>, const T &t) {
+        mProgram.mConstants.push_back(static_cast<Element>(t));
+        return Arg{ArgKind::Constant, std::uint32_t(mProgram.mConstants.size() - 1)};
+    }
+
+    template <typename Fn>
+    Arg operator() (yap::expr_tag<yap::expr_kind::call>, Fn &&fn) {
+        std::decay_t<Fn> f = fn;
+        mProgram.mCalls.push_back([f] { return static_cast<Element>(f()); });
+        Arg dest = NewTemp(Shape{});
+        Instr instr{Opcode::Call, dest.index, {}};
+        instr.callee = mProgram.mCalls.size() - 1;
+        mProgram.mCode.push_back(instr);
+        return dest;
+    }
+
+    template <yap::expr_kind Kind, typename Expr1, typename Expr2,
+              typename = std::enable_if_t<Kind != yap::expr_kind::call>>
+    Arg operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) {
+        static_assert(Kind == yap::expr_kind::plus || Kind == yap::expr_kind::multiplies,
+                      "No instruction for this operator");
+        Arg x = yap::transform(yap::as_expr(lhs), *this);
+        Arg y = yap::transform(yap::as_expr(rhs), *this);
+        // Elementwise ops broadcast rank 0 operands; otherwise the shapes must match.
+        Shape shape = ShapeOf(x);
+        if (shape.empty())
+            shape = ShapeOf(y);
+        assert((ShapeOf(y).empty() || ShapeOf(y) == shape) && "Tensor shapes of an elementwise op must match");
+        Arg dest = NewTemp(shape);
+        Instr instr{Kind == yap::expr_kind::plus ? Opcode::Add : Opcode::Mul, dest.index, {}};
+        instr.src[0] = x;
+        instr.src[1] = y;
+        mProgram.mCode.push_back(instr);
+        return dest;
+    }
+};
+
+template <typename Expr>
+Program Lower(const Expr &expr) {
+    Program program;
+    yap::transform(yap::as_expr(expr), LowerXform{program});
+    assert(!program.mCode.empty() && "Nothing to lower");
+    return program;
+}
+
+// The temps an instruction reads.
+template <typename Fn>
+void ForEachTempUse(const Program &program, const Instr &instr, Fn &&fn) {
+    if (instr.op == Opcode::Call || instr.op == Opcode::CopyIn)
+        return;
+    auto visit = [&fn](Arg arg) {
+        if (arg.kind == ArgKind::Temp)
+            fn(arg.index);
+    };
+    if (instr.op == Opcode::Fused)
+        std::for_each(program.mKernels[instr.kernel].mArgs.begin(), program.mKernels[instr.kernel].mArgs.end(), visit);
+    else if (instr.op == Opcode::CopyOut)
+        visit(instr.src[0]);
+    else
+        std::for_each(std::begin(instr.src), std::end(instr.src), visit);
+}
+
+// Fuses chains of elementwise instructions.  An Add or Mul is folded into its
+// consumer when the consumer is also an Add or Mul of the same shape and is
+// the only instruction reading its temp; each remaining root becomes one
+// Fused instruction computing its whole tree strip by strip, so the folded
+// temps are never written to memory.  Temps are renumbered densely.
+Program FuseElementwise(const Program &program) {
+    auto const &code = program.mCode;
+    auto elementwise = [&](const Instr &instr) {
+        return (instr.op == Opcode::Add || instr.op == Opcode::Mul) && !program.mTempShapes[instr.dest].empty();
+    };
+
+    std::vector<std::size_t> defOf(program.NumTemps());
+    std::vector<std::size_t> uses(program.NumTemps(), 0);
+    for (std::size_t k = 0; k < code.size(); ++k) {
+        defOf[code[k].dest] = k;
+        ForEachTempUse(program, code[k], [&](std::uint32_t t) { uses[t]++; });
+    }
+    // folded[k]: instruction k is computed inside its consumer's kernel
+    std::vector<bool> folded(code.size(), false);
+    for (auto const &instr : code) {
+        if (!elementwise(instr))
+            continue;
+        ForEachTempUse(program, instr, [&](std::uint32_t t) {
+            auto const &producer = code[defOf[t]];
+            if (uses[t] == 1 && elementwise(producer) &&
+                program.mTempShapes[t] == program.mTempShapes[instr.dest])
+                folded[defOf[t]] = true;
+        });
+    }
+
+    Program fused;
+    fused.mInputs = program.mInputs;
+    fused.mConstants = program.mConstants;
+    fused.mCalls = program.mCalls;
+    fused.mKernels = program.mKernels;
+    std::vector<std::uint32_t> renamed(program.NumTemps());
+    auto rename = [&renamed](Arg arg) {
+        if (arg.kind == ArgKind::Temp)
+            arg.index = renamed[arg.index];
+        return arg;
+    };
+
+    for (std::size_t k = 0; k < code.size(); ++k) {
+        if (folded[k])
+            continue;
+        Instr instr = code[k];
+        bool root = false;
+        ForEachTempUse(program, instr, [&](std::uint32_t t) { root = root || folded[defOf[t]]; });
+        if (root) {
+            FusedKernel kernel;
+            // Emits the micro-ops computing arg, returning the slot holding it
+            std::function<Slot(Arg)> emit = [&](Arg arg) {
+                if (arg.kind == ArgKind::Temp && folded[defOf[arg.index]]) {
+                    auto const &producer = code[defOf[arg.index]];
+                    MicroOp op{producer.op, {emit(producer.src[0]), emit(producer.src[1])}};
+                    kernel.mOps.push_back(op);
+                    return Slot{true, std::uint32_t(kernel.mOps.size() - 1)};
+                }
+                kernel.mArgs.push_back(rename(arg));
+                return Slot{false, std::uint32_t(kernel.mArgs.size() - 1)};
+            };
+            MicroOp op{instr.op, {emit(instr.src[0]), emit(instr.src[1])}};
+            kernel.mOps.push_back(op);
+            fused.mKernels.push_back(kernel);
+            instr.op = Opcode::Fused;
+            instr.kernel = fused.mKernels.size() - 1;
+        } else if (instr.op == Opcode::Add || instr.op == Opcode::Mul) {
+            instr.src[0] = rename(instr.src[0]);
+            instr.src[1] = rename(instr.src[1]);
+        } else if (instr.op == Opcode::Fused) {
+            for (auto &arg : fused.mKernels[instr.kernel].mArgs)
+                arg = rename(arg);
+        }
+        renamed[instr.dest] = fused.NumTemps();
+        fused.mTempShapes.push_back(program.mTempShapes[instr.dest]);
+        instr.dest = renamed[instr.dest];
+        fused.mCode.push_back(instr);
+    }
+    return fused;
+}
+
+// For each temp, the index of the last instruction that reads it, or
+// mCode.size() when none does.
+std::vector<std::size_t> LastUses(const Program &program) {
+    std::vector<std::size_t> lastUse(program.NumTemps(), program.mCode.size());
+    for (std::size_t k = 0; k < program.mCode.size(); ++k)
+        ForEachTempUse(program, program.mCode[k], [&](std::uint32_t t) { lastUse[t] = k; });
+    return lastUse;
+}
+
+// Assigns a buffer to every temp of a program.  As AllocBuffer in Example14
+// does, a temp's buffer is reused by later temps once the last instruction
+// reading it has been allocated; here liveness and the linear scan are plain
+// loops over the instructions.  Returns one tensor per temp; temps that share
+// a buffer have tensors with the same id.
+std::vector<Tensor> AllocTemps(const Program &program, std::size_t *numBuffers = nullptr) {
+    std::uint32_t numTemps = program.NumTemps();
+    auto lastUse = LastUses(program);
+
+    std::vector<Tensor> buffers;
+    std::vector<std::size_t> free;
+    std::vector<std::size_t> bufferOf(numTemps);
+    std::vector<Tensor> temps;
+    temps.reserve(numTemps);
+    for (std::size_t k = 0; k < program.mCode.size(); ++k) {
+        std::uint32_t dest = program.mCode[k].dest;
+        const Shape &shape = program.mTempShapes[dest];
+        std::size_t n = NumElements(shape);
+        // Best fit: the smallest free buffer that is large enough
+        auto best = free.end();
+        for (auto it = free.begin(); it != free.end(); ++it) {
+            std::size_t size = buffers[*it].size();
+            if (size >= n && (best == free.end() || size < buffers[*best].size()))
+                best = it;
+        }
+        if (best != free.end()) {
+            bufferOf[dest] = *best;
+            free.erase(best);
+        } else {
+            bufferOf[dest] = buffers.size();
+            buffers.push_back(MakeTensor(buffers.size() + 1, shape));
+        }
+        assert(temps.size() == dest && "Temps are defined in order");
+        temps.push_back(buffers[bufferOf[dest]]);
+        temps.back().shape = shape;
+        // Operands are released only after dest is allocated, so an
+        // instruction never writes a buffer it reads.
+        ForEachTempUse(program, program.mCode[k], [&](std::uint32_t t) {
+            if (lastUse[t] == k && std::find(free.begin(), free.end(), bufferOf[t]) == free.end())
+                free.push_back(bufferOf[t]);
+        });
+    }
+    if (numBuffers)
+        *numBuffers = buffers.size();
+    return temps;
+}
+
+// One buffer per temp.  Costs more memory than AllocTemps, but adds no
+// dependences between instructions that share a buffer (see BuildDag).
+std::vector<Tensor> DistinctTemps(const Program &program) {
+    std::vector<Tensor> temps;
+    for (std::uint32_t t = 0; t < program.NumTemps(); ++t)
+        temps.push_back(MakeTensor(t + 1, program.mTempShapes[t]));
+    return temps;
+}
+
+Operand MakeOperand(const Program &program, const std::vector<Tensor> &temps, Arg arg) {
+    switch (arg.kind) {
+        case ArgKind::Input:
+            return MakeOperand(program.mInputs[arg.index]);
+        case ArgKind::Temp:
+            return MakeOperand(temps[arg.index]);
+        default:
+            return Operand{nullptr, program.mConstants[arg.index]};
+    }
+}
+
+// Elements per strip of a fused kernel: each register is 2 KiB, so the
+// registers of a kernel stay in L1.
+constexpr std::size_t kStrip = 512;
+
+// Runs the kernel on elements [begin, end) of out.  begin must be a multiple
+// of kStrip.
+void RunFused(const Program &program, const FusedKernel &kernel, const Tensor &out,
+              const std::vector<Tensor> &temps, std::size_t begin = 0, std::size_t end = SIZE_MAX) {
+    std::vector<Operand> args;
+    for (auto arg : kernel.mArgs)
+        args.push_back(MakeOperand(program, temps, arg));
+    Tensor regs = MakeTensor(0, Shape{kernel.mOps.size(), kStrip});
+    std::size_t n = std::min(end, out.size());
+    for (std::size_t first = begin; first < n; first += kStrip) {
+        std::size_t len = std::min(kStrip, n - first);
+        auto operand = [&](Slot slot) {
+            return slot.reg ? Operand{regs.data() + slot.index * kStrip, 0} : Offset(args[slot.index], first);
+        };
+        for (std::size_t i = 0; i < kernel.mOps.size(); ++i) {
+            auto const &op = kernel.mOps[i];
+            Element *dst = i + 1 == kernel.mOps.size() ? out.data() + first : regs.data() + i * kStrip;
+            if (op.op == Opcode::Add)
+                Elementwise(dst, len, operand(op.src[0]), operand(op.src[1]), [](Element x, Element y) { return x + y; });
+            else
+                Elementwise(dst, len, operand(op.src[0]), operand(op.src[1]), [](Element x, Element y) { return x * y; });
+        }
+    }
+}
+
+// Runs one compute instruction on the given temps.
+void ExecuteInstr(const Program &program, const Instr &instr, const std::vector<Tensor> &temps) {
+    const Tensor &out = temps[instr.dest];
+    switch (instr.op) {
+        case Opcode::Add:
+            TensorAdd(out, MakeOperand(program, temps, instr.src[0]), MakeOperand(program, temps, instr.src[1]));
+            break;
+        case Opcode::Mul:
+            TensorMul(out, MakeOperand(program, temps, instr.src[0]), MakeOperand(program, temps, instr.src[1]));
+            break;
+        case Opcode::Call:
+            out.Fill(program.mCalls[instr.callee]());
+            break;
+        case Opcode::Fused:
+            RunFused(program, program.mKernels[instr.kernel], out, temps);
+            break;
+        default:
+            assert(false && "Copies only run in ExecuteStaged");
+    }
+}
+
+// Runs the program on the given temps and returns the result tensor.
+Tensor Execute(const Program &program, const std::vector<Tensor> &temps) {
+    for (auto const &instr : program.mCode)
+        ExecuteInstr(program, instr, temps);
+    return temps[program.Result()];
+}
+
+// Rewrites a program to run tile by tile out of small local buffers, in the
+// form for_(...) -> (a.CopyTo<UBUF>() + ...).CopyTo<GM>(out) sketched in
+// Example7.  Every tensor input gets a CopyIn into a tile-sized temp at the
+// start of the program, every temp that is not rank 0 shrinks to one tile, and
+// a CopyOut writes the result tile to Program::mOutputs[0].  Rank 0 temps do
+// not depend on the tile.
+Program StageTiles(const Program &program, std::size_t tile) {
+    Program staged = program;
+    staged.mCode.clear();
+    staged.mTempShapes.clear();
+    auto const &resultShape = program.mTempShapes[program.Result()];
+    assert(!resultShape.empty() && "Nothing to tile");
+
+    std::vector<std::uint32_t> renamed(program.NumTemps());
+    std::vector<std::uint32_t> local(program.mInputs.size());
+    auto newTemp = [&staged](const Shape &shape) {
+        staged.mTempShapes.push_back(shape);
+        return staged.NumTemps() - 1;
+    };
+    for (std::size_t i = 0; i < program.mInputs.size(); ++i) {
+        if (program.mInputs[i].shape.empty())
+            continue;
+        assert(program.mInputs[i].shape == resultShape && "Only elementwise programs can be tiled");
+        Instr copy{Opcode::CopyIn, newTemp(Shape{tile}), {}};
+        copy.src[0] = Arg{ArgKind::Input, std::uint32_t(i)};
+        local[i] = copy.dest;
+        staged.mCode.push_back(copy);
+    }
+    auto rename = [&](Arg arg) {
+        if (arg.kind == ArgKind::Temp)
+            arg.index = renamed[arg.index];
+        else if (arg.kind == ArgKind::Input && !program.mInputs[arg.index].shape.empty())
+            arg = Arg{ArgKind::Temp, local[arg.index]};
+        return arg;
+    };
+
+    for (Instr instr : program.mCode) {
+        if (instr.op == Opcode::Add || instr.op == Opcode::Mul) {
+            instr.src[0] = rename(instr.src[0]);
+            instr.src[1] = rename(instr.src[1]);
+        } else if (instr.op == Opcode::Fused) {
+            for (auto &arg : staged.mKernels[instr.kernel].mArgs)
+                arg = rename(arg);
+        }
+        auto const &shape = program.mTempShapes[instr.dest];
+        renamed[instr.dest] = newTemp(shape.empty() ? shape : Shape{tile});
+        instr.dest = renamed[instr.dest];
+        staged.mCode.push_back(instr);
+    }
+
+    staged.mOutputs.push_back(MakeTensor(0, resultShape));
+    Instr copy{Opcode::CopyOut, 0, {}};
+    copy.src[0] = Arg{ArgKind::Temp, renamed[program.Result()]};
+    staged.mCode.push_back(copy);
+    return staged;
+}
+
+// A background thread standing in for a DMA engine: copies run one at a time
+// in submission order while the caller computes.
+class CopyEngine {
+public:
+    CopyEngine() : mThread([this] { Run(); }) {}
+
+    ~CopyEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCond.notify_one();
+        mThread.join();
+    }
+
+    std::future<void> Submit(std::function<void()> job) {
+        std::packaged_task<void()> task(std::move(job));
+        auto done = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQueue.push_back(std::move(task));
+        }
+        mCond.notify_one();
+        return done;
+    }
+
+private:
+    void Run() {
+        for (;;) {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCond.wait(lock, [this] { return mStop || !mQueue.empty(); });
+                if (mQueue.empty())
+                    return;
+                task = std::move(mQueue.front());
+                mQueue.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<std::packaged_task<void()>> mQueue;
+    bool mStop = false;
+    std::thread mThread;
+};
+
+// Milliseconds spent in each stage of ExecuteStaged.  Copies are timed on
+// whichever thread runs them; wait is the time compute spent blocked on a
+// copy, so with full overlap wall is close to compute + wait.
+struct StageTimes {
+    double copyIn = 0;
+    double compute = 0;
+    double copyOut = 0;
+    double wait = 0;
+    double wall = 0;
+};
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs a staged program over all tiles and returns its output.  With
+// doubleBuffer, the temps exist twice: while tile i is computed in one set,
+// the copy engine loads tile i + 1 into the other and then stores tile i.
+// Without it, copies and compute simply alternate on the calling thread.
+Tensor ExecuteStaged(const Program &program, bool doubleBuffer, StageTimes *times = nullptr) {
+    auto const &out = program.mOutputs[0];
+    std::size_t tile = 0;
+    for (auto const &shape : program.mTempShapes)
+        tile = std::max(tile, NumElements(shape));
+    std::size_t n = out.size();
+    std::size_t numTiles = (n + tile - 1) / tile;
+
+    // Rank 0 temps are computed once, before the first tile, and shared by
+    // both sets
+    std::vector<Tensor> sets[2];
+    for (int s = 0; s < 2; ++s) {
+        for (std::uint32_t t = 0; t < program.NumTemps(); ++t) {
+            auto const &shape = program.mTempShapes[t];
+            sets[s].push_back(s && shape.empty() ? sets[0][t] : MakeTensor(t + 1, shape));
+        }
+    }
+    for (auto const &instr : program.mCode) {
+        if (instr.op != Opcode::CopyIn && instr.op != Opcode::CopyOut && program.mTempShapes[instr.dest].empty())
+            ExecuteInstr(program, instr, sets[0]);
+    }
+
+    StageTimes local;
+    auto copyIn = [&](std::size_t i, int s) {
+        auto start = std::chrono::steady_clock::now();
+        std::size_t first = i * tile, len = std::min(tile, n - first);
+        for (auto const &instr : program.mCode) {
+            if (instr.op == Opcode::CopyIn)
+                std::copy_n(program.mInputs[instr.src[0].index].data() + first, len, sets[s][instr.dest].data());
+        }
+        local.copyIn += MsSince(start);
+    };
+    auto copyOut = [&](std::size_t i, int s) {
+        auto start = std::chrono::steady_clock::now();
+        std::size_t first = i * tile, len = std::min(tile, n - first);
+        for (auto const &instr : program.mCode) {
+            if (instr.op == Opcode::CopyOut)
+                std::copy_n(sets[s][instr.src[0].index].data(), len, program.mOutputs[instr.dest].data() + first);
+        }
+        local.copyOut += MsSince(start);
+    };
+    // The last tile may be partial; the elements past its end are computed
+    // on stale data and never copied out.
+    auto compute = [&](int s) {
+        auto start = std::chrono::steady_clock::now();
+        for (auto const &instr : program.mCode) {
+            if (instr.op != Opcode::CopyIn && instr.op != Opcode::CopyOut && !program.mTempShapes[instr.dest].empty())
+                ExecuteInstr(program, instr, sets[s]);
+        }
+        local.compute += MsSince(start);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    if (doubleBuffer) {
+        CopyEngine engine;
+        std::future<void> loaded = engine.Submit([&] { copyIn(0, 0); });
+        std::future<void> stored;
+        for (std::size_t i = 0; i < numTiles; ++i) {
+            int s = i % 2;
+            auto waitStart = std::chrono::steady_clock::now();
+            loaded.wait();
+            local.wait += MsSince(waitStart);
+            // Set 1 - s was last used by tile i - 1, whose store was submitted
+            // before this load, so the engine finishes reading it first.
+            if (i + 1 < numTiles)
+                loaded = engine.Submit([&, i, s] { copyIn(i + 1, 1 - s); });
+            compute(s);
+            stored = engine.Submit([&, i, s] { copyOut(i, s); });
+        }
+        auto waitStart = std::chrono::steady_clock::now();
+        stored.wait();
+        local.wait += MsSince(waitStart);
+    } else {
+        for (std::size_t i = 0; i < numTiles; ++i) {
+            copyIn(i, 0);
+            compute(0);
+            copyOut(i, 0);
+        }
+    }
+    local.wall = MsSince(start);
+    if (times)
+        *times = local;
+    return out;
+}
+
+// A thread pool in which every worker has its own deque of tasks.  A worker
+// pushes the tasks it spawns onto the back of its own deque and pops from the
+// back, so related work stays on one core; when its deque is empty it steals
+// from the front of the others'.  Tasks submitted from outside the pool are
+// dealt to the deques in turn.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned numThreads = std::max(1u, std::thread::hardware_concurrency())) {
+        for (unsigned i = 0; i < numThreads; ++i)
+            mQueues.push_back(std::make_unique<Queue>());
+        for (unsigned i = 0; i < numThreads; ++i)
+            mThreads.emplace_back([this, i] { Run(i); });
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCond.notify_all();
+        for (auto &thread : mThreads)
+            thread.join();
+    }
+
+    unsigned Size() const { return mThreads.size(); }
+
+    void Submit(std::function<void()> task) {
+        unsigned q = tPool == this ? tWorker : mNext++ % mQueues.size();
+        // Counted before it is published, so a thief's TryPop never takes
+        // mQueued below zero.
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            ++mQueued;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mQueues[q]->mutex);
+            mQueues[q]->tasks.push_back(std::move(task));
+        }
+        mCond.notify_one();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool TryPop(unsigned self, std::function<void()> &task) {
+        for (unsigned k = 0; k < mQueues.size(); ++k) {
+            Queue &queue = *mQueues[(self + k) % mQueues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (k == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            --mQueued;
+            return true;
+        }
+        return false;
+    }
+
+    void Run(unsigned self) {
+        tPool = this;
+        tWorker = self;
+        for (;;) {
+            std::function<void()> task;
+            if (TryPop(self, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.wait(lock, [this] { return mStop || mQueued > 0; });
+            if (mStop && mQueued == 0)
+                return;
+        }
+    }
+
+    static thread_local const WorkStealingPool *tPool;
+    static thread_local unsigned tWorker;
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<std::thread> mThreads;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::atomic<std::size_t> mQueued{0};
+    std::atomic<unsigned> mNext{0};
+    bool mStop = false;
+};
+
+thread_local const WorkStealingPool *WorkStealingPool::tPool = nullptr;
+thread_local unsigned WorkStealingPool::tWorker = 0;
+
+// The dependences between the instructions of a program once its temps have
+// buffers.  Besides reading a temp after it is written, an instruction must
+// not overwrite a buffer shared with an earlier temp (see AllocTemps) before
+// the earlier temp's readers and writer are done with it.
+struct Dag {
+    std::vector<std::vector<std::uint32_t>> mSuccs;  // Indexed by instruction
+    std::vector<std::uint32_t> mNumPreds;
+};
+
+Dag BuildDag(const Program &program, const std::vector<Tensor> &temps) {
+    std::size_t numInstrs = program.mCode.size();
+    Dag dag{std::vector<std::vector<std::uint32_t>>(numInstrs), std::vector<std::uint32_t>(numInstrs)};
+    std::vector<std::uint32_t> defOf(program.NumTemps());
+    // Per buffer id: the last instruction to write it and the instructions
+    // that have read it since.
+    std::vector<std::int64_t> lastWriter;
+    std::vector<std::vector<std::uint32_t>> readers;
+    auto edge = [&dag](std::uint32_t from, std::uint32_t to) {
+        auto &succs = dag.mSuccs[from];
+        if (from != to && std::find(succs.begin(), succs.end(), to) == succs.end()) {
+            succs.push_back(to);
+            ++dag.mNumPreds[to];
+        }
+    };
+    for (std::uint32_t k = 0; k < numInstrs; ++k) {
+        auto const &instr = program.mCode[k];
+        std::size_t buffer = temps[instr.dest].id;
+        if (buffer >= lastWriter.size()) {
+            lastWriter.resize(buffer + 1, -1);
+            readers.resize(buffer + 1);
+        }
+        ForEachTempUse(program, instr, [&](std::uint32_t t) { edge(defOf[t], k); });
+        if (lastWriter[buffer] >= 0)
+            edge(lastWriter[buffer], k);
+        for (auto reader : readers[buffer])
+            edge(reader, k);
+        ForEachTempUse(program, instr, [&](std::uint32_t t) { readers[temps[t].id].push_back(k); });
+        readers[buffer].clear();
+        lastWriter[buffer] = k;
+        defOf[instr.dest] = k;
+    }
+    return dag;
+}
+
+// Elements per task when an elementwise instruction is split across the
+// pool.  A multiple of kStrip, so fused kernels split on strip boundaries.
+constexpr std::size_t kSplit = std::size_t(1) << 16;
+
+// Runs elements [begin, end) of an Add, Mul or Fused instruction.
+void ExecuteRange(const Program &program, const Instr &instr, const std::vector<Tensor> &temps,
+                  std::size_t begin, std::size_t end) {
+    const Tensor &out = temps[instr.dest];
+    if (instr.op == Opcode::Fused) {
+        RunFused(program, program.mKernels[instr.kernel], out, temps, begin, end);
+        return;
+    }
+    Operand lhs = Offset(MakeOperand(program, temps, instr.src[0]), begin);
+    Operand rhs = Offset(MakeOperand(program, temps, instr.src[1]), begin);
+    if (instr.op == Opcode::Add)
+        Elementwise(out.data() + begin, end - begin, lhs, rhs, [](Element x, Element y) { return x + y; });
+    else
+        Elementwise(out.data() + begin, end - begin, lhs, rhs, [](Element x, Element y) { return x * y; });
+}
+
+// Runs the program on the pool as soon as each instruction's predecessors in
+// the Dag are done, so independent subtrees run at the same time.  With temps
+// from AllocTemps, buffer reuse serializes much of the program; DistinctTemps
+// leaves only the true dependences.
+// Elementwise instructions over more than kSplit elements are further split
+// into one task per kSplit elements.  Returns once the whole program is done.
+Tensor ExecuteParallel(const Program &program, const std::vector<Tensor> &temps, WorkStealingPool &pool) {
+    Dag dag = BuildDag(program, temps);
+    std::size_t numInstrs = program.mCode.size();
+    std::unique_ptr<std::atomic<std::uint32_t>[]> preds(new std::atomic<std::uint32_t>[numInstrs]);
+    std::unique_ptr<std::atomic<std::size_t>[]> chunks(new std::atomic<std::size_t>[numInstrs]);
+    for (std::size_t k = 0; k < numInstrs; ++k)
+        preds[k] = dag.mNumPreds[k];
+
+    std::mutex mutex;
+    std::condition_variable done;
+    std::size_t numDone = 0;
+    std::function<void(std::uint32_t)> start;
+    auto finish = [&](std::uint32_t k) {
+        for (auto succ : dag.mSuccs[k]) {
+            if (--preds[succ] == 0)
+                start(succ);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (++numDone == numInstrs)
+            done.notify_one();
+    };
+    start = [&](std::uint32_t k) {
+        auto const &instr = program.mCode[k];
+        std::size_t n = temps[instr.dest].size();
+        bool split = instr.op == Opcode::Add || instr.op == Opcode::Mul || instr.op == Opcode::Fused;
+        if (!split || n <= kSplit) {
+            pool.Submit([&, k] {
+                ExecuteInstr(program, program.mCode[k], temps);
+                finish(k);
+            });
+            return;
+        }
+        chunks[k] = (n + kSplit - 1) / kSplit;
+        for (std::size_t begin = 0; begin < n; begin += kSplit) {
+            pool.Submit([&, k, begin, n] {
+                ExecuteRange(program, program.mCode[k], temps, begin, std::min(begin + kSplit, n));
+                if (--chunks[k] == 0)
+                    finish(k);
+            });
+        }
+    };
+
+    for (std::uint32_t k = 0; k < numInstrs; ++k) {
+        if (dag.mNumPreds[k] == 0)
+            start(k);
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return numDone == numInstrs; });
+    return temps[program.Result()];
+}
+
+void PrintDag(const Program &program, const Dag &dag) {
+    for (std::size_t k = 0; k < program.mCode.size(); ++k) {
+        std::cout << "    t" << program.mCode[k].dest << ": " << dag.mNumPreds[k] << " preds, succs {";
+        for (std::size_t i = 0; i < dag.mSuccs[k].size(); ++i)
+            std::cout << (i ? ", " : "") << "t" << program.mCode[dag.mSuccs[k][i]].dest;
+        std::cout << "}" << std::endl;
+    }
+}
+
+// The leaves of an expression, in the order LowerXform meets them: the
+// distinct tensors, which of them each tensor terminal is, the constants and
+// the callables.
+struct Bindings {
+    std::vector<Tensor> mInputs;
+    std::vector<std::uint32_t> mInputOfLeaf;
+    std::vector<Element> mConstants;
+    std::vector<std::function<Element()>> mCalls;
+};
+
+struct BindXform {
+    Bindings &mBindings;
+
+    int operator() (yap::expr_tag<yap::expr_kind::terminal>, const Tensor &t) {
+        auto &inputs = mBindings.mInputs;
+        auto it = std::find_if(inputs.begin(), inputs.end(), [&t](const Tensor &in) { return in.data() == t.data(); });
+        if (it == inputs.end())
+            it = inputs.insert(inputs.end(), t);
+        mBindings.mInputOfLeaf.push_back(it - inputs.begin());
+        return 0;
+    }
+
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic<std::decay_t<T>>::value>>
+    int operator() (yap::expr_tag<yap::expr_kind::terminal>, const T &t) {
+        mBindings.mConstants.push_back(static_cast<Element>(t));
+        return 0;
+    }
+
+    template <typename Fn>
+    int operator() (yap::expr_tag<yap::expr_kind::call>, Fn &&fn) {
+        std::decay_t<Fn> f = fn;
+        mBindings.mCalls.push_back([f] { return static_cast<Element>(f()); });
+        return 0;
+    }
+
+    template <yap::expr_kind Kind, typename Expr1, typename Expr2,
+              typename = std::enable_if_t<Kind != yap::expr_kind::call>>
+    int operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) {
+        yap::transform(yap::as_expr(lhs), *this);
+        yap::transform(yap::as_expr(rhs), *this);
+        return 0;
+    }
+};
+
+// What a plan depends on besides the data: the expression type, which
+// terminals are the same tensor, and the tensor shapes.  Constants and
+// callables are rebound like tensor data, since no pass folds them.
+struct PlanKey {
+    std::type_index mType;
+    std::vector<std::uint32_t> mInputOfLeaf;
+    std::vector<Shape> mShapes;
+
+    bool operator== (const PlanKey &other) const {
+        return mType == other.mType && mInputOfLeaf == other.mInputOfLeaf && mShapes == other.mShapes;
+    }
+};
+
+struct PlanKeyHash {
+    std::size_t operator() (const PlanKey &key) const {
+        std::size_t h = key.mType.hash_code();
+        auto combine = [&h](std::size_t v) { h ^= v + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2); };
+        for (auto i : key.mInputOfLeaf)
+            combine(i);
+        for (auto const &shape : key.mShapes) {
+            combine(shape.size());
+            for (auto d : shape)
+                combine(d);
+        }
+        return h;
+    }
+};
+
+// Whether t reads any element of the temps.
+bool Aliases(const Tensor &t, const std::vector<Tensor> &temps) {
+    for (auto const &temp : temps) {
+        if (t.data() < temp.data() + temp.size() && temp.data() < t.data() + t.size())
+            return true;
+    }
+    return false;
+}
+
+// A tensor with the shape and elements of t in a buffer of its own.
+Tensor CopyOf(const Tensor &t) {
+    Tensor copy = MakeTensor(t.id, t.shape);
+    std::copy_n(t.data(), t.size(), copy.data());
+    return copy;
+}
+
+// Lowered, fused programs with their temps, keyed by expression structure.
+// Run lowers, fuses and allocates an expression the first time its PlanKey is
+// seen; after that it only walks the expression to rebind the inputs,
+// constants and calls of the cached program.  The result lives in the plan's
+// temps, so it is only valid until the next Run with the same key.  It may be
+// passed back in as an input of that Run, which then reads a copy of it.
+class PlanCache {
+public:
+    template <typename Expr>
+    Tensor Run(const Expr &expr) {
+        Bindings bindings;
+        yap::transform(yap::as_expr(expr), BindXform{bindings});
+        PlanKey key{typeid(Expr), std::move(bindings.mInputOfLeaf), {}};
+        for (auto const &input : bindings.mInputs)
+            key.mShapes.push_back(input.shape);
+
+        auto it = mPlans.find(key);
+        if (it == mPlans.end()) {
+            ++mMisses;
+            Program program = FuseElementwise(Lower(expr));
+            auto temps = AllocTemps(program);
+            it = mPlans.emplace(std::move(key), Plan{std::move(program), std::move(temps)}).first;
+        } else {
+            ++mHits;
+            // The program writes its temps while it reads its inputs
+            for (auto &input : bindings.mInputs) {
+                if (Aliases(input, it->second.mTemps))
+                    input = CopyOf(input);
+            }
+        }
+        Program &program = it->second.mProgram;
+        program.mInputs = std::move(bindings.mInputs);
+        program.mConstants = std::move(bindings.mConstants);
+        program.mCalls = std::move(bindings.mCalls);
+        return Execute(program, it->second.mTemps);
+    }
+
+    std::size_t Size() const { return mPlans.size(); }
+    std::size_t Hits() const { return mHits; }
+    std::size_t Misses() const { return mMisses; }
+
+private:
+    struct Plan {
+        Program mProgram;
+        std::vector<Tensor> mTemps;
+    };
+
+    std::unordered_map<PlanKey, Plan, PlanKeyHash> mPlans;
+    std::size_t mHits = 0;
+    std::size_t mMisses = 0;
+};
+
+int foo() { return 1; }
+
+template <typename Fn>
+double TimeMs(int repeat, Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+        fn();
+        // Keep the compiler from merging the repetitions.
+        asm volatile("" ::: "memory");
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / repeat;
+}
+
+// Tiles start on kAlignment boundaries so that the kernels still see aligned
+// pointers.
+constexpr std::size_t kTileQuantum = kAlignment / sizeof(Element);
+
+// Elements [first, first + n) of t, sharing its buffer.
+Tensor Slice(const Tensor &t, std::size_t first, std::size_t n) {
+    Tensor view = t;
+    view.buffer = std::shared_ptr<Element>(t.buffer, t.data() + first);
+    view.shape = Shape{n};
+    return view;
+}
+
+// A program set up to run one tile of the result at a time: every
+// instruction runs on elements [first, first + tile) before any runs on the
+// next tile, so the temps a tile passes between kernels are still in cache
+// when they are read.  Temps that are not rank 0 are only one tile long; rank
+// 0 temps are computed once per run, up front.  Works on fused and unfused
+// programs; every tensor input must have the shape of the result.
+//
+// Everything a run needs, including the result, is allocated here, so that
+// RunTiled itself allocates nothing.
+struct TiledProgram {
+    std::size_t mTile;
+    Program mTiled; // The program with its tensor inputs and temps cut to one tile
+    std::vector<Tensor> mTemps;
+    Tensor mResult;
+};
+
+TiledProgram PrepareTiled(const Program &program, std::size_t tile) {
+    tile = std::max(kTileQuantum, tile / kTileQuantum * kTileQuantum);
+    auto const &resultShape = program.mTempShapes[program.Result()];
+    std::size_t n = NumElements(resultShape);
+    for ([[maybe_unused]] auto const &input : program.mInputs)
+        assert((input.shape.empty() || input.shape == resultShape) && "Only elementwise programs can be tiled");
+
+    Program tiled = program;
+    for (auto &shape : tiled.mTempShapes) {
+        if (!shape.empty())
+            shape = Shape{std::min(tile, n)};
+    }
+    for (auto &input : tiled.mInputs) {
+        if (!input.shape.empty())
+            input.shape = Shape{std::min(tile, n)};
+    }
+    auto temps = AllocTemps(tiled);
+    return TiledProgram{tile, std::move(tiled), std::move(temps), MakeTensor(0, resultShape)};
+}
+
+// Runs program, which t was prepared from, into t.mResult.
+void RunTiled(const Program &program, TiledProgram &t) {
+    for (auto const &instr : program.mCode) {
+        if (program.mTempShapes[instr.dest].empty())
+            ExecuteInstr(t.mTiled, instr, t.mTemps);
+    }
+
+    // Points view at elements [first, first + len) of whole, without
+    // allocating: view already has a rank 1 shape.
+    auto slice = [](Tensor &view, const Tensor &whole, std::size_t first, std::size_t len) {
+        view.buffer = std::shared_ptr<Element>(whole.buffer, whole.data() + first);
+        view.shape[0] = len;
+    };
+    // The last instruction writes the result and nothing reads it, so its
+    // tile can go straight to the output.  An earlier temp may share the
+    // result's buffer, but every temp has its own tensor, so re-pointing the
+    // result's tensor leaves theirs on the shared buffer.
+    Tensor &result = t.mTemps[program.Result()];
+    std::size_t n = t.mResult.size();
+    for (std::size_t first = 0; first < n; first += t.mTile) {
+        std::size_t len = std::min(t.mTile, n - first);
+        for (std::size_t i = 0; i < program.mInputs.size(); ++i) {
+            if (!program.mInputs[i].shape.empty())
+                slice(t.mTiled.mInputs[i], program.mInputs[i], first, len);
+        }
+        for (std::uint32_t k = 0; k < t.mTiled.NumTemps(); ++k) {
+            if (!t.mTiled.mTempShapes[k].empty())
+                t.mTemps[k].shape[0] = len;
+        }
+        slice(result, t.mResult, first, len);
+        for (auto const &instr : program.mCode) {
+            if (!program.mTempShapes[instr.dest].empty())
+                ExecuteInstr(t.mTiled, instr, t.mTemps);
+        }
+    }
+}
+
+Tensor ExecuteTiled(const Program &program, std::size_t tile) {
+    TiledProgram t = PrepareTiled(program, tile);
+    RunTiled(program, t);
+    return t.mResult;
+}
+
+// Bytes of L2 per core, or 1 MiB when the system does not say.
+std::size_t L2CacheBytes() {
+    long bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return bytes > 0 ? std::size_t(bytes) : std::size_t(1) << 20;
+}
+
+// The tile at which one tile of every input, buffer and the output together
+// take half of L2, leaving the rest for whatever else is live.  Once tiled,
+// every rank 1 temp takes one tile, so the buffers are the most rank 1 temps
+// live at once.
+std::size_t DefaultTile(const Program &program) {
+    auto lastUse = LastUses(program);
+    std::vector<std::size_t> dying(program.mCode.size() + 1);
+    for (std::uint32_t t = 0; t < program.NumTemps(); ++t)
+        dying[lastUse[t]] += !program.mTempShapes[t].empty();
+    std::size_t buffers = 0;
+    std::size_t live = 0;
+    for (std::size_t k = 0; k < program.mCode.size(); ++k) {
+        live += !program.mTempShapes[program.mCode[k].dest].empty();
+        buffers = std::max(buffers, live);
+        live -= dying[k];
+    }
+    for (auto const &input : program.mInputs)
+        buffers += !input.shape.empty();
+    std::size_t tile = L2CacheBytes() / 2 / (sizeof(Element) * (buffers + 1));
+    return std::max(kTileQuantum, tile / kTileQuantum * kTileQuantum);
+}
+
+// The fastest of repeat runs of fn, after one run to warm up the caches.
+template <typename Fn>
+double MinTimeMs(int repeat, Fn &&fn) {
+    fn();
+    double best = TimeMs(1, fn);
+    for (int r = 1; r < repeat; ++r)
+        best = std::min(best, TimeMs(1, fn));
+    return best;
+}
+
+// Times RunTiled at powers of two from a quarter of DefaultTile up to sixteen
+// times it.  Returns the fastest tile, or DefaultTile unless some tile beats
+// it by at least 5%, since smaller differences are mostly noise.
+std::size_t TuneTile(const Program &program, int repeat = 15) {
+    std::size_t start = DefaultTile(program);
+    auto time = [&](std::size_t tile) {
+        TiledProgram t = PrepareTiled(program, tile);
+        return MinTimeMs(repeat, [&] { RunTiled(program, t); });
+    };
+    std::size_t best = start;
+    double bestMs = time(start) * 0.95;
+    std::size_t tile = kTileQuantum;
+    while (tile * 4 < start)
+        tile *= 2;
+    for (; tile <= start * 16; tile *= 2) {
+        if (tile == start)
+            continue;
+        double ms = time(tile);
+        if (ms < bestMs) {
+            best = tile;
+            bestMs = ms;
+        }
+    }
+    return best;
+}
+
+// x * (x + x * (x + ...)) with N multiplies: 2 * N - 1 instructions.  With
+// GenIR the type of the IR list grows with every instruction, so anything
+// near this size no longer compiles in reasonable time.
+template <int N, typename X>
+auto Nested(const X &x) {
+    if constexpr (N == 1)
+        return x * 2;
+    else
+        return x * (x + Nested<N - 1>(x));
+}
+
+// Runs f(a, b, c) over n-element tensors: execution of the program as lowered
+// and after FuseElementwise, the whole pipeline including lowering, fusion
+// and allocation, and the same f applied in a hand-written loop.
+template <typename F>
+void Bench(const char *name, std::size_t n, int repeat, F &&f) {
+    Tensor a = MakeTensor(100, Shape{n});
+    Tensor b = MakeTensor(101, Shape{n});
+    Tensor c = MakeTensor(102, Shape{n});
+    for (std::size_t i = 0; i < n; ++i) {
+        a.data()[i] = Element(i % 17);
+        b.data()[i] = Element(i % 5) * 0.5f;
+        c.data()[i] = Element(i % 3);
+    }
+    auto ta = yap::make_terminal(a), tb = yap::make_terminal(b), tc = yap::make_terminal(c);
+    auto expr = f(ta, tb, tc);
+
+    Program program = Lower(expr);
+    Program fused = FuseElementwise(program);
+    auto temps = AllocTemps(program);
+    auto fusedTemps = AllocTemps(fused);
+    Tensor result = MakeTensor(0, Shape{});
+    Tensor fusedResult = MakeTensor(0, Shape{});
+    double unfusedMs = TimeMs(repeat, [&] { result = Execute(program, temps); });
+    double fusedMs = TimeMs(repeat, [&] { fusedResult = Execute(fused, fusedTemps); });
+    double pipeline = TimeMs(repeat, [&] {
+        Program p = FuseElementwise(Lower(expr));
+        fusedResult = Execute(p, AllocTemps(p));
+    });
+
+    Tensor ref = MakeTensor(200, Shape{n});
+    double loop = TimeMs(repeat, [&] {
+        for (std::size_t i = 0; i < n; ++i)
+            ref.data()[i] = f(a.data()[i], b.data()[i], c.data()[i]);
+    });
+
+    assert(result.shape == ref.shape && fusedResult.shape == ref.shape);
+    for (std::size_t i = 0; i < n; ++i)
+        assert(result.data()[i] == ref.data()[i] && fusedResult.data()[i] == ref.data()[i]);
+
+    printf("%s over %zu floats: %zu kernels %.3f ms, fused into %zu %.3f ms, pipeline %.3f ms, hand-written loop %.3f ms\n",
+           name, n, program.mCode.size(), unfusedMs, fused.mCode.size(), fusedMs, pipeline, loop);
+}
+
+// Runs f over tiles of the given size, with copies alternating with compute
+// and with double-buffered copies on the copy engine, and prints the time
+// spent in each stage.
+template <typename F>
+void BenchStaged(const char *name, std::size_t n, std::size_t tile, int repeat, F &&f) {
+    Tensor a = MakeTensor(100, Shape{n});
+    Tensor b = MakeTensor(101, Shape{n});
+    Tensor c = MakeTensor(102, Shape{n});
+    for (std::size_t i = 0; i < n; ++i) {
+        a.data()[i] = Element(i % 17);
+        b.data()[i] = Element(i % 5) * 0.5f;
+        c.data()[i] = Element(i % 3);
+    }
+    Program fused = FuseElementwise(Lower(f(yap::make_terminal(a), yap::make_terminal(b), yap::make_terminal(c))));
+    Program staged = StageTiles(fused, tile);
+    Tensor ref = Execute(fused, AllocTemps(fused));
+    double wholeMs = TimeMs(repeat, [&] { Execute(fused, AllocTemps(fused)); });
+
+    printf("%s over %zu floats, whole tensors: %.3f ms\n", name, n, wholeMs);
+    for (bool doubleBuffer : {false, true}) {
+        StageTimes total;
+        for (int r = 0; r < repeat; ++r) {
+            StageTimes times;
+            ExecuteStaged(staged, doubleBuffer, &times);
+            total.copyIn += times.copyIn / repeat;
+            total.compute += times.compute / repeat;
+            total.copyOut += times.copyOut / repeat;
+            total.wait += times.wait / repeat;
+            total.wall += times.wall / repeat;
+        }
+        [[maybe_unused]] auto const &out = staged.mOutputs[0];
+        for (std::size_t i = 0; i < n; ++i)
+            assert(out.data()[i] == ref.data()[i]);
+        printf("  tile %zu, %-14s copy in %.3f ms, compute %.3f ms, copy out %.3f ms, waiting %.3f ms, wall %.3f ms\n",
+               tile, doubleBuffer ? "double buffer:" : "serial:", total.copyIn, total.compute, total.copyOut,
+               total.wait, total.wall);
+    }
+}
+
+// Compares running the whole pipeline on every call with a PlanCache, for
+// calls that see new tensors of the same shape each time.
+template <typename F>
+void BenchPlanCache(const char *name, std::size_t n, int repeat, F &&f) {
+    std::vector<Tensor> inputs;
+    for (int k = 0; k < 6; ++k) {
+        inputs.push_back(MakeTensor(100 + k, Shape{n}));
+        for (std::size_t i = 0; i < n; ++i)
+            inputs.back().data()[i] = Element((i + k) % 7);
+    }
+    // Runs g on the expression over the r-th rotation of the inputs.
+    auto with = [&](int r, auto &&g) {
+        auto ta = yap::make_terminal(inputs[r % 6]);
+        auto tb = yap::make_terminal(inputs[(r + 1) % 6]);
+        auto tc = yap::make_terminal(inputs[(r + 2) % 6]);
+        return g(f(ta, tb, tc));
+    };
+    auto pipeline = [](const auto &expr) {
+        Program p = FuseElementwise(Lower(expr));
+        return Execute(p, AllocTemps(p));
+    };
+
+    int r = 0;
+    double pipelineMs = TimeMs(repeat, [&] { with(r++, pipeline); });
+    PlanCache cache;
+    auto cached = [&cache](const auto &expr) { return cache.Run(expr); };
+    r = 0;
+    double cachedMs = TimeMs(repeat, [&] { with(r++, cached); });
+    for (r = 0; r < 6; ++r) {
+        Tensor ref = with(r, pipeline);
+        Tensor result = with(r, cached);
+        for (std::size_t i = 0; i < n; ++i)
+            assert(result.data()[i] == ref.data()[i]);
+    }
+    printf("%s over %zu floats: pipeline %.3f us, plan cache %.3f us per call (%zu plans, %zu hits, %zu misses)\n",
+           name, n, pipelineMs * 1e3, cachedMs * 1e3, cache.Size(), cache.Hits(), cache.Misses());
+}
+
+// Compares Execute with ExecuteParallel on pools of one and of numThreads
+// threads.
+template <typename F>
+void BenchParallel(const char *name, std::size_t n, int repeat, unsigned numThreads, F &&f) {
+    Tensor a = MakeTensor(100, Shape{n});
+    Tensor b = MakeTensor(101, Shape{n});
+    Tensor c = MakeTensor(102, Shape{n});
+    for (std::size_t i = 0; i < n; ++i) {
+        a.data()[i] = Element(i % 17);
+        b.data()[i] = Element(i % 5) * 0.5f;
+        c.data()[i] = Element(i % 3);
+    }
+    Program program = Lower(f(yap::make_terminal(a), yap::make_terminal(b), yap::make_terminal(c)));
+    auto temps = DistinctTemps(program);
+    Tensor ref = Execute(program, temps);
+    double serialMs = TimeMs(repeat, [&] { Execute(program, temps); });
+
+    printf("%s over %zu floats: Execute %.3f ms", name, n, serialMs);
+    for (unsigned threads : {1u, numThreads}) {
+        WorkStealingPool pool(threads);
+        Tensor result = ExecuteParallel(program, temps, pool);
+        for (std::size_t i = 0; i < n; ++i)
+            assert(result.data()[i] == ref.data()[i]);
+        printf(", %u threads %.3f ms", threads, TimeMs(repeat, [&] { ExecuteParallel(program, temps, pool); }));
+    }
+    printf("\n");
+}
+
+// Compares whole-tensor execution with RunTiled at the default and the
+// auto-tuned tile, for the program as lowered and after fusion.
+template <typename F>
+void BenchTiled(const char *name, std::size_t n, int repeat, F &&f) {
+    Tensor a = MakeTensor(100, Shape{n});
+    Tensor b = MakeTensor(101, Shape{n});
+    Tensor c = MakeTensor(102, Shape{n});
+    for (std::size_t i = 0; i < n; ++i) {
+        a.data()[i] = Element(i % 17);
+        b.data()[i] = Element(i % 5) * 0.5f;
+        c.data()[i] = Element(i % 3);
+    }
+    Program program = Lower(f(yap::make_terminal(a), yap::make_terminal(b), yap::make_terminal(c)));
+    Program fused = FuseElementwise(program);
+    Tensor ref = Execute(program, AllocTemps(program));
+
+    printf("%s over %zu floats (L2 %zu KiB):\n", name, n, L2CacheBytes() >> 10);
+    for (const Program *p : {&program, &fused}) {
+        auto temps = AllocTemps(*p);
+        double wholeMs = MinTimeMs(repeat, [&] { Execute(*p, temps); });
+        std::size_t defaultTile = DefaultTile(*p);
+        std::size_t tunedTile = TuneTile(*p);
+        TiledProgram atDefault = PrepareTiled(*p, defaultTile);
+        double defaultMs = MinTimeMs(repeat, [&] { RunTiled(*p, atDefault); });
+        for (std::size_t i = 0; i < n; ++i)
+            assert(atDefault.mResult.data()[i] == ref.data()[i]);
+        double tunedMs = defaultMs;
+        if (tunedTile != defaultTile) {
+            TiledProgram atTuned = PrepareTiled(*p, tunedTile);
+            tunedMs = MinTimeMs(repeat, [&] { RunTiled(*p, atTuned); });
+        }
+        printf("  %zu instructions: whole tensors %.3f ms, tile %zu %.3f ms, tuned tile %zu %.3f ms\n",
+               p->mCode.size(), wholeMs, defaultTile, defaultMs, tunedTile, tunedMs);
+    }
+}
+
+int main() {
+    Tensor a = MakeTensor(100, Shape{4, 4});
+    Tensor b = MakeTensor(101, Shape{4, 4});
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        a.data()[i] = Element(i);
+        b.data()[i] = Element(10 * i);
+    }
+    {
+        auto call_foo = yap::make_terminal(foo);
+        auto expr = yap::make_terminal(a) * 2 + call_foo() + yap::make_terminal(b) * 3;
+        yap::print(std::cout, expr);
+        Program program = Lower(expr);
+        PrintProgram(program);
+
+        std::size_t numBuffers = 0;
+        auto temps = AllocTemps(program, &numBuffers);
+        printf("AllocTemps: %u temps in %zu buffers\n", program.NumTemps(), numBuffers);
+        auto result = Execute(program, temps);
+        std::cout << "result = " << result << std::endl;
+        for (std::size_t i = 0; i < a.size(); ++i)
+            assert(result.data()[i] == a.data()[i] * 2 + foo() + b.data()[i] * 3);
+
+        // The call result is rank 0: it stays a separate instruction and the
+        // fused kernel reads it as a scalar argument.
+        Program fused = FuseElementwise(program);
+        PrintProgram(fused);
+        auto fusedResult = Execute(fused, AllocTemps(fused));
+        for (std::size_t i = 0; i < a.size(); ++i)
+            assert(fusedResult.data()[i] == result.data()[i]);
+    }
+    {
+        Tensor x = MakeTensor(102, Shape{1 << 10});
+        x.Fill(1);
+        Program program = FuseElementwise(Lower(Nested<64>(yap::make_terminal(x))));
+        std::size_t numBuffers = 0;
+        auto result = Execute(program, AllocTemps(program, &numBuffers));
+        printf("Nested<64>: %zu instructions, %u temps in %zu buffers, result[0] = %g\n",
+               program.mCode.size(), program.NumTemps(), numBuffers, result.data()[0]);
+    }
+
+    auto axpy = [](auto const &a, auto const &b, auto const &c) { return a * b + c * 2; };
+    auto chain = [](auto const &a, auto const &b, auto const &c) { return (a + b) * c + (a * 3 + b) * (c + 1) + a; };
+    Bench("a * b + c * 2", 1 << 12, 10000, axpy);
+    Bench("a * b + c * 2", 1 << 22, 20, axpy);
+    Bench("(a + b) * c + (a * 3 + b) * (c + 1) + a", 1 << 22, 20, chain);
+
+    {
+        Tensor x = MakeTensor(103, Shape{10});
+        Tensor y = MakeTensor(104, Shape{10});
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            x.data()[i] = Element(i);
+            y.data()[i] = Element(2 * i);
+        }
+        auto call_foo = yap::make_terminal(foo);
+        auto tx = yap::make_terminal(x), ty = yap::make_terminal(y);
+        Program staged = StageTiles(FuseElementwise(Lower((tx + ty) * call_foo() + tx)), 4);
+        PrintProgram(staged);
+        auto const &out = ExecuteStaged(staged, true);
+        std::cout << "staged result = " << out << std::endl;
+        for (std::size_t i = 0; i < x.size(); ++i)
+            assert(out.data()[i] == (x.data()[i] + y.data()[i]) * foo() + x.data()[i]);
+    }
+    {
+        // The expression left commented out in Example14: the two products
+        // and the call do not depend on each other.
+        Tensor x = MakeTensor(106, Shape{1 << 18});
+        Tensor y = MakeTensor(107, Shape{1 << 18});
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            x.data()[i] = Element(i % 100);
+            y.data()[i] = Element(i % 10);
+        }
+        auto call_foo = yap::make_terminal(foo);
+        Program program = Lower(yap::make_terminal(x) * 2 + call_foo() + yap::make_terminal(y) * 3);
+        auto temps = DistinctTemps(program);
+        PrintProgram(program);
+        PrintDag(program, BuildDag(program, temps));
+        std::cout << "  with AllocTemps:" << std::endl;
+        PrintDag(program, BuildDag(program, AllocTemps(program)));
+        WorkStealingPool pool(4);
+        auto result = ExecuteParallel(program, temps, pool);
+        std::cout << "parallel result = " << result << std::endl;
+        for (std::size_t i = 0; i < x.size(); ++i)
+            assert(result.data()[i] == x.data()[i] * 2 + foo() + y.data()[i] * 3);
+    }
+    BenchParallel("a * b + c * 2", 1 << 22, 20, 4, axpy);
+    BenchParallel("(a + b) * c + (a * 3 + b) * (c + 1) + a", 1 << 22, 20, 4, chain);
+
+    {
+        PlanCache cache;
+        Tensor x = MakeTensor(108, Shape{8});
+        Tensor y = MakeTensor(109, Shape{8});
+        Tensor z = MakeTensor(110, Shape{16});
+        x.Fill(1);
+        y.Fill(2);
+        z.Fill(3);
+        auto tx = yap::make_terminal(x), ty = yap::make_terminal(y), tz = yap::make_terminal(z);
+        [[maybe_unused]] Element r1 = cache.Run(tx * 2 + ty).data()[0];
+        assert(r1 == 4);
+        // Same structure and shapes: a hit, with y in place of x and 3 for 2
+        [[maybe_unused]] Element r2 = cache.Run(ty * 3 + tx).data()[0];
+        assert(r2 == 7);
+        // The same tensor twice, or another shape: new plans
+        [[maybe_unused]] Element r3 = cache.Run(tx * 2 + tx).data()[0];
+        assert(r3 == 3);
+        [[maybe_unused]] Element r4 = cache.Run(tz * 2 + tz).data()[0];
+        assert(r4 == 9);
+        // A hit whose input is the result of the previous Run of the plan
+        Tensor r5 = cache.Run((tx * 2 + ty) * (tx + 1));
+        auto tr5 = yap::make_terminal(r5);
+        Tensor r6 = cache.Run((tr5 * 2 + ty) * (tr5 + 1));
+        for (std::size_t i = 0; i < r6.size(); ++i)
+            assert(r6.data()[i] == 162);
+        printf("PlanCache: %zu plans, %zu hits, %zu misses\n", cache.Size(), cache.Hits(), cache.Misses());
+    }
+    BenchPlanCache("a * b + c * 2", 64, 100000, axpy);
+    BenchPlanCache("(a + b) * c + (a * 3 + b) * (c + 1) + a", 64, 100000, chain);
+    BenchPlanCache("(a + b) * c + (a * 3 + b) * (c + 1) + a", 1 << 16, 1000, chain);
+
+    {
+        Tensor x = MakeTensor(105, Shape{100});
+        for (std::size_t i = 0; i < x.size(); ++i)
+            x.data()[i] = Element(i);
+        auto call_foo = yap::make_terminal(foo);
+        auto tx = yap::make_terminal(x);
+        Program program = Lower(tx * tx + call_foo() * tx + 2);
+        auto result = ExecuteTiled(program, 32);
+        std::cout << "tiled result = " << result << std::endl;
+        for (std::size_t i = 0; i < x.size(); ++i)
+            assert(result.data()[i] == x.data()[i] * x.data()[i] + foo() * x.data()[i] + 2);
+    }
+    BenchTiled("a * b + c * 2", 1 << 22, 20, axpy);
+    BenchTiled("(a + b) * c + (a * 3 + b) * (c + 1) + a", 1 << 22, 20, chain);
+
+    BenchStaged("a * b + c * 2", 1 << 22, 1 << 14, 20, axpy);
+    BenchStaged("(a + b) * c + (a * 3 + b) * (c + 1) + a", 1 << 22, 1 << 14, 20, chain);
+}
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <cmath>
 
+#include "../trace.hpp"
+
 namespace yap = boost::yap;
 namespace hana = boost::hana;
 
@@ -56,6 +58,7 @@ std::ostream& operator<< (std::ostream &os, Number (*f)(const Number &, const Nu
 
 using namespace boost::yap::literals;
 
+template <typename Trace = DefaultTrace>
 struct Transformer {
     // template <typename T>
     // auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&t) {
@@ -67,7 +70,7 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::plus>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("plus_expr matched\n");
+        Trace::Record("plus_expr matched");
         return yap::make_expression<yap::expr_kind::call>(
             yap::make_terminal(Add),
             yap::transform(yap::as_expr(lhs), *this),
@@ -78,7 +81,7 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::multiplies>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("mult_expr matched\n");
+        Trace::Record("mult_expr matched");
         return yap::make_expression<yap::expr_kind::call>(
             yap::make_terminal(Mul),
             yap::transform(yap::as_expr(lhs), *this),
@@ -105,7 +108,8 @@ void TestNumberExpr() {
     std::cout << "- Before transformation:\n";
     yap::print(std::cout, expr1);
 
-    auto expr2 = yap::transform(expr1, Transformer{});
+    auto expr2 = yap::transform(expr1, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
 
     std::cout << "- After transformation:\n";
     yap::print(std::cout, expr2);
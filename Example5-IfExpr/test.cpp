@@ -1,8 +1,15 @@
 #include <boost/yap/expression.hpp>
 #include <boost/yap/print.hpp>
 
+#include <cassert>
+#include <chrono>
 #include <iostream>
 #include <cmath>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "../trace.hpp"
 
 namespace yap = boost::yap;
 namespace hana = boost::hana;
@@ -59,12 +66,21 @@ using namespace boost::yap::literals;
 struct IfExpr {};
 struct ForExpr {};
 
+// True for conditions whose value is known at compile time, such as
+// std::true_type or hana::false_c.  hana::bool_ derives from
+// std::integral_constant, so one check covers both.
+template <typename T, typename = void>
+struct IsStaticBool : std::false_type {};
+
+template <typename T>
+struct IsStaticBool<T, std::enable_if_t<std::is_base_of<std::integral_constant<bool, T::value>, T>::value>>
+    : std::true_type {};
+
+template <typename Trace = DefaultTrace>
 struct Transformer {
     template <typename T>
     auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&t) {
-        printf("Terminal matched\n");
-        PrintTypeName(t);
-        std::cout << t << std::endl;
+        Trace::Record("Terminal matched", TypeName<T>());
         // return yap::make_terminal(t);
         return t;
     }
@@ -72,7 +88,7 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::plus>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("plus_expr matched\n");
+        Trace::Record("plus_expr matched");
         return yap::transform(yap::as_expr(lhs), *this) +
                yap::transform(yap::as_expr(rhs), *this);
     }
@@ -80,7 +96,7 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::multiplies>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("mult_expr matched\n");
+        Trace::Record("mult_expr matched");
         return yap::make_expression<yap::expr_kind::call>(
             yap::make_terminal(Mul),
             yap::transform(yap::as_expr(lhs), *this),
@@ -91,25 +107,187 @@ struct Transformer {
     template <typename Cond, typename Then, typename Else>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::call>,
                      IfExpr const & if_expr, Cond && cond_expr, Then && then_expr, Else && else_expr) {
-        std::cout << "If matched" << std::endl;
-        bool cond = yap::transform(yap::as_expr(cond_expr), *this);
-        if (cond) {
-            std::cout << "then_expr transformed" << std::endl;
-            return yap::transform(yap::as_expr(then_expr), *this);
+        Trace::Record("If matched");
+        // A compile-time condition selects its branch here; the other one is
+        // never transformed, so it is never instantiated, and the two
+        // branches need not even have the same type.
+        if constexpr (IsStaticBool<std::decay_t<Cond>>::value) {
+            if constexpr (std::decay_t<Cond>::value) {
+                Trace::Record("then_expr selected statically");
+                return yap::transform(yap::as_expr(then_expr), *this);
+            } else {
+                Trace::Record("else_expr selected statically");
+                return yap::transform(yap::as_expr(else_expr), *this);
+            }
         } else {
-            std::cout << "else_expr transformed" << std::endl;
-            return yap::transform(yap::as_expr(else_expr), *this);
+            bool cond = yap::transform(yap::as_expr(cond_expr), *this);
+            if (cond) {
+                Trace::Record("then_expr transformed");
+                return yap::transform(yap::as_expr(then_expr), *this);
+            } else {
+                Trace::Record("else_expr transformed");
+                return yap::transform(yap::as_expr(else_expr), *this);
+            }
         }
     }
 
     template <typename Callable, typename ... Args>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::call>,
                      Callable callable, Args ... args) {
-        std::cout << "Call matched" << std::endl;
+        Trace::Record("Call matched");
         return  callable(yap::transform(yap::as_expr(args), *this)...);
     }
 };
 
+// Elementwise if_ over std::vector terminals.  A branch that is cheap and
+// safe to evaluate for every element is evaluated for every element and the
+// results are blended by the mask, which the compiler turns into a SIMD select
+// instead of a branch per element.  Any other branch keeps the short-circuit
+// form: only the chosen branch is evaluated.
+
+struct EvalAt;
+
+// Evaluates to hana::true_ if the expression must only be evaluated where the
+// condition selects it: it contains a call (other than a nested if_), an
+// assignment or an increment/decrement, whose effects would show, or an
+// integral division or modulus, a dereference or a subscript, which the
+// condition may be guarding against a zero divisor, a null pointer or an
+// index out of range.
+struct NeedsShortCircuit {
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&) {
+        return hana::false_c;
+    }
+
+    template <typename Callable, typename... Args>
+    auto operator() (yap::expr_tag<yap::expr_kind::call>, Callable &&, Args &&... args) {
+        if constexpr (std::is_same<std::decay_t<Callable>, IfExpr>::value)
+            return hana::bool_c<(decltype(yap::transform(yap::as_expr(args), *this))::value || ...)>;
+        else
+            return hana::true_c;
+    }
+
+    template <yap::expr_kind Kind, typename... Args>
+    auto operator() (yap::expr_tag<Kind>, Args &&... args) {
+        return hana::bool_c<Unsafe<Kind, Args...>() || (decltype(yap::transform(yap::as_expr(args), *this))::value || ...)>;
+    }
+
+    template <yap::expr_kind Kind, typename... Args>
+    static constexpr bool Unsafe() {
+        if constexpr (Kind == yap::expr_kind::pre_inc || Kind == yap::expr_kind::pre_dec ||
+                      Kind == yap::expr_kind::post_inc || Kind == yap::expr_kind::post_dec ||
+                      (Kind >= yap::expr_kind::assign && Kind <= yap::expr_kind::bitwise_xor_assign))
+            return true;
+        else if constexpr (Kind == yap::expr_kind::dereference || Kind == yap::expr_kind::subscript)
+            return true;
+        else if constexpr (Kind == yap::expr_kind::divides || Kind == yap::expr_kind::modulus)
+            return (std::is_integral<std::decay_t<decltype(yap::transform(yap::as_expr(std::declval<Args>()),
+                                                                          std::declval<EvalAt const &>()))>>::value && ...);
+        else
+            return false;
+    }
+};
+
+template <typename Expr>
+constexpr bool CanBlend() {
+    return !decltype(yap::transform(yap::as_expr(std::declval<Expr>()), NeedsShortCircuit{}))::value;
+}
+
+template <yap::expr_kind Kind, typename L, typename R>
+auto ApplyOp(L const &l, R const &r) {
+    if constexpr (Kind == yap::expr_kind::plus)
+        return l + r;
+    else if constexpr (Kind == yap::expr_kind::minus)
+        return l - r;
+    else if constexpr (Kind == yap::expr_kind::multiplies)
+        return l * r;
+    else if constexpr (Kind == yap::expr_kind::divides)
+        return l / r;
+    else if constexpr (Kind == yap::expr_kind::modulus)
+        return l % r;
+    else if constexpr (Kind == yap::expr_kind::less)
+        return l < r;
+    else if constexpr (Kind == yap::expr_kind::greater)
+        return l > r;
+    else if constexpr (Kind == yap::expr_kind::less_equal)
+        return l <= r;
+    else if constexpr (Kind == yap::expr_kind::greater_equal)
+        return l >= r;
+    else if constexpr (Kind == yap::expr_kind::equal_to)
+        return l == r;
+    else if constexpr (Kind == yap::expr_kind::not_equal_to)
+        return l != r;
+    else if constexpr (Kind == yap::expr_kind::logical_and)
+        return l && r;
+    else if constexpr (Kind == yap::expr_kind::logical_or)
+        return l || r;
+    else
+        static_assert(Kind == yap::expr_kind::plus, "Unsupported operator in elementwise expression");
+}
+
+// Evaluates element i of an expression over std::vector terminals.  Other
+// terminals are broadcast.
+struct EvalAt {
+    template <typename T>
+    T operator() (yap::expr_tag<yap::expr_kind::terminal>, std::vector<T> const &v) const {
+        return v[i];
+    }
+
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T const &t) const {
+        return t;
+    }
+
+    template <typename Expr>
+    auto operator() (yap::expr_tag<yap::expr_kind::negate>, Expr &&expr) const {
+        return -yap::transform(yap::as_expr(expr), *this);
+    }
+
+    template <yap::expr_kind Kind, typename Expr1, typename Expr2,
+              typename = std::enable_if_t<Kind != yap::expr_kind::call>>
+    auto operator() (yap::expr_tag<Kind>, Expr1 &&lhs, Expr2 &&rhs) const {
+        return ApplyOp<Kind>(yap::transform(yap::as_expr(lhs), *this),
+                             yap::transform(yap::as_expr(rhs), *this));
+    }
+
+    template <typename Cond, typename Then, typename Else>
+    auto Select(Cond &&cond_expr, Then &&then_expr, Else &&else_expr) const {
+        if constexpr (IsStaticBool<std::decay_t<Cond>>::value) {
+            if constexpr (std::decay_t<Cond>::value)
+                return yap::transform(yap::as_expr(then_expr), *this);
+            else
+                return yap::transform(yap::as_expr(else_expr), *this);
+        } else if constexpr (CanBlend<Then>() && CanBlend<Else>()) {
+            auto t = yap::transform(yap::as_expr(then_expr), *this);
+            auto e = yap::transform(yap::as_expr(else_expr), *this);
+            return yap::transform(yap::as_expr(cond_expr), *this) ? t : e;
+        } else {
+            return yap::transform(yap::as_expr(cond_expr), *this)
+                       ? yap::transform(yap::as_expr(then_expr), *this)
+                       : yap::transform(yap::as_expr(else_expr), *this);
+        }
+    }
+
+    template <typename Callable, typename... Args>
+    auto operator() (yap::expr_tag<yap::expr_kind::call>, Callable &&callable, Args &&... args) const {
+        if constexpr (std::is_same<std::decay_t<Callable>, IfExpr>::value)
+            return Select(args...);
+        else
+            return callable(yap::transform(yap::as_expr(args), *this)...);
+    }
+
+    std::size_t i;
+};
+
+// Assigns e to out elementwise.
+template <typename T, typename Expr>
+std::vector<T> & assign(std::vector<T> &out, Expr const &e) {
+    decltype(auto) expr = yap::as_expr(e);
+    for (std::size_t i = 0, n = out.size(); i < n; ++i)
+        out[i] = yap::transform(expr, EvalAt{i});
+    return out;
+}
+
 int Inc(int i) { return i + 1; }
 
 void TestNumberExpr() {
@@ -131,7 +309,8 @@ void TestNumberExpr() {
     std::cout << "- Before transformation:\n";
     yap::print(std::cout, expr1);
 
-    auto expr2 = yap::transform(expr1, Transformer{});
+    auto expr2 = yap::transform(expr1, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
 
     std::cout << "- After transformation:\n";
     std::cout << expr2 << std::endl;
@@ -142,6 +321,102 @@ void TestNumberExpr() {
     // std::cout << r1 << std::endl;
 }
 
+// With a compile-time condition only the live branch is transformed.  The
+// branches below have different types, which a runtime condition would not
+// allow.
+void TestStaticIf() {
+    auto term2 = yap::make_terminal(2);
+    auto num = yap::make_terminal(Number(1.0));
+    auto copy_ = yap::make_terminal(Copy);
+    auto if_ = yap::make_terminal(IfExpr{});
+
+    auto expr1 = if_(yap::make_terminal(std::true_type{}), term2 + term2, copy_(num));
+    auto r1 = yap::transform(expr1, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
+    static_assert(std::is_same<decltype(r1), int>::value, "then_expr is selected");
+    std::cout << "- Static then: " << r1 << std::endl;
+
+    auto expr2 = if_(yap::make_terminal(hana::false_c), term2 + term2, copy_(num));
+    auto r2 = yap::transform(expr2, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
+    static_assert(std::is_same<decltype(r2), Number>::value, "else_expr is selected");
+    std::cout << "- Static else: " << r2 << std::endl;
+}
+
+long gLog1pCalls = 0;
+
+double Log1p(double x) {
+    gLog1pCalls++;
+    return std::log1p(x);
+}
+
+template <typename Fn>
+double TimeMs(Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void TestSelect() {
+    std::size_t const n = 1 << 22;
+    std::vector<double> a(n), b(n), out(n), ref(n);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    for (std::size_t i = 0; i < n; ++i) {
+        a[i] = dist(rng);
+        b[i] = dist(rng);
+    }
+    auto if_ = yap::make_terminal(IfExpr{});
+    auto ta = yap::make_terminal(a);
+    auto tb = yap::make_terminal(b);
+
+    // Random mask: a branch per element would be mispredicted half the time.
+    auto select = if_(ta < 0.5, ta * 2.0, tb + 1.0);
+    static_assert(CanBlend<decltype(ta * 2.0)>() && CanBlend<decltype(tb + 1.0)>(), "Both branches blend");
+    double blendMs = TimeMs([&] { assign(out, select); });
+    double branchMs = TimeMs([&] {
+        for (std::size_t i = 0; i < n; ++i) {
+            if (a[i] < 0.5)
+                ref[i] = a[i] * 2.0;
+            else
+                ref[i] = b[i] + 1.0;
+        }
+    });
+    assert(out == ref);
+    std::cout << "- if_ over " << n << " doubles: blended " << blendMs << " ms, branch per element "
+              << branchMs << " ms" << std::endl;
+
+    // A call in a branch keeps the short-circuit form: Log1p() only runs for
+    // the elements that select it.
+    auto log1p_ = yap::make_terminal(Log1p);
+    auto guarded = if_(ta < 0.25, log1p_(ta), tb);
+    static_assert(!CanBlend<decltype(log1p_(ta))>(), "Calls do not blend");
+    gLog1pCalls = 0;
+    assign(out, guarded);
+    long selected = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        assert(out[i] == (a[i] < 0.25 ? std::log1p(a[i]) : b[i]));
+        selected += a[i] < 0.25;
+    }
+    assert(gLog1pCalls == selected);
+    std::cout << "- Log1p() called " << gLog1pCalls << " times for " << n << " elements" << std::endl;
+
+    // Integer division keeps the short-circuit form too, so the condition
+    // guards the zero divisors; floating-point division still blends.
+    std::vector<int> ia{7, 8, 9, 10}, ib{2, 0, 3, 0}, iout(4);
+    auto tia = yap::make_terminal(ia);
+    auto tib = yap::make_terminal(ib);
+    static_assert(!CanBlend<decltype(tia / tib)>() && !CanBlend<decltype(tia % tib)>(),
+                  "Integer division does not blend");
+    static_assert(CanBlend<decltype(ta / tb)>(), "Floating-point division blends");
+    assign(iout, if_(tib != 0, tia / tib, 0));
+    assert((iout == std::vector<int>{3, 0, 3, 0}));
+    assign(iout, if_(tib != 0, tia % tib, -1));
+    assert((iout == std::vector<int>{1, -1, 0, -1}));
+}
+
 int main() {
     TestNumberExpr();
+    TestStaticIf();
+    TestSelect();
 }
\ No newline at end of file
@@ -1,8 +1,19 @@
 #include <boost/yap/expression.hpp>
 #include <boost/yap/print.hpp>
+#include <boost/hana/back.hpp>
+#include <boost/hana/concat.hpp>
+#include <boost/hana/drop_back.hpp>
+#include <boost/hana/for_each.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <future>
 #include <iostream>
 #include <cmath>
+#include <memory>
+#include <vector>
+
+#include "../trace.hpp"
 
 namespace yap = boost::yap;
 namespace hana = boost::hana;
@@ -13,6 +24,7 @@ public:
     Number() : x(0.0) {}
     Number(double x) : x(x) {}
     Number(const Number &other) : x(other.x) {}
+    Number &operator= (const Number &other) = default;
 
     friend std::ostream& operator<< (std::ostream &os, const Number &number);
 };
@@ -59,12 +71,95 @@ using namespace boost::yap::literals;
 struct IfExpr {};
 struct ForExpr {};
 
+// The objects one comma operand reads and writes.  Only terminals held by
+// reference can be shared with another operand; a terminal held by value is
+// a private copy and is ignored.  Assignments and increments write their
+// left operand.  A call may touch anything, so it makes the operand opaque
+// and it conflicts with every other one.
+struct AccessSets {
+    template <typename T>
+    auto operator() (yap::expression<yap::expr_kind::terminal, hana::tuple<T>> const &expr) {
+        if constexpr (std::is_reference<T>::value) {
+            void const *object = &yap::value(expr);
+            mReads.push_back(object);
+            if (mWriting)
+                mWrites.push_back(object);
+        }
+        return 0;
+    }
+
+    template <yap::expr_kind Kind, typename Tuple>
+    auto operator() (yap::expression<Kind, Tuple> const &expr) {
+        if constexpr (Kind == yap::expr_kind::call)
+            mOpaque = true;
+        if constexpr (IsWrite(Kind)) {
+            bool writing = mWriting;
+            mWriting = true;
+            yap::transform(yap::left(expr), *this);
+            mWriting = writing;
+            if constexpr (yap::detail::arity_of<Kind>() == yap::detail::expr_arity::two)
+                yap::transform(yap::right(expr), *this);
+        } else {
+            hana::for_each(expr.elements, [this](auto const &element) { yap::transform(element, *this); });
+        }
+        return 0;
+    }
+
+    static constexpr bool IsWrite(yap::expr_kind kind) {
+        switch (kind) {
+        case yap::expr_kind::pre_inc: case yap::expr_kind::pre_dec:
+        case yap::expr_kind::post_inc: case yap::expr_kind::post_dec:
+        case yap::expr_kind::assign: case yap::expr_kind::plus_assign:
+        case yap::expr_kind::minus_assign: case yap::expr_kind::multiplies_assign:
+        case yap::expr_kind::divides_assign: case yap::expr_kind::modulus_assign:
+        case yap::expr_kind::shift_left_assign: case yap::expr_kind::shift_right_assign:
+        case yap::expr_kind::bitwise_and_assign: case yap::expr_kind::bitwise_or_assign:
+        case yap::expr_kind::bitwise_xor_assign:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Two operands conflict unless neither writes what the other one touches.
+    bool ConflictsWith(AccessSets const &other) const {
+        auto overlaps = [](std::vector<void const *> const &a, std::vector<void const *> const &b) {
+            return std::any_of(a.begin(), a.end(), [&](void const *p) {
+                return std::find(b.begin(), b.end(), p) != b.end();
+            });
+        };
+        return mOpaque || other.mOpaque || overlaps(mWrites, other.mReads) || overlaps(other.mWrites, mReads);
+    }
+
+    std::vector<void const *> mReads;
+    std::vector<void const *> mWrites;
+    bool mOpaque = false;
+    bool mWriting = false;
+};
+
+template <typename Expr>
+decltype(auto) Deref(Expr const &expr) {
+    if constexpr (Expr::kind == yap::expr_kind::expr_ref)
+        return Deref(yap::deref(expr));
+    else
+        return expr;
+}
+
+// Flattens a comma sequence into pointers to its operands, in order.
+template <typename Expr>
+auto CommaOperands(Expr const &expr) {
+    auto const &e = Deref(expr);
+    if constexpr (std::decay_t<decltype(e)>::kind == yap::expr_kind::comma)
+        return hana::concat(CommaOperands(yap::left(e)), CommaOperands(yap::right(e)));
+    else
+        return hana::make_tuple(std::addressof(e));
+}
+
+template <typename Trace = DefaultTrace>
 struct Transformer {
     template <typename T>
     auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&t) {
-        printf("Terminal matched\n");
-        PrintTypeName(t);
-        std::cout << t << std::endl;
+        Trace::Record("Terminal matched", TypeName<T>());
         // return yap::make_terminal(t);
         return t;
     }
@@ -72,7 +167,7 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::plus>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("plus_expr matched\n");
+        Trace::Record("plus_expr matched");
         return Add(yap::transform(yap::as_expr(lhs), *this),
                    yap::transform(yap::as_expr(rhs), *this));
     }
@@ -80,29 +175,75 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::multiplies>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("mult_expr matched\n");
+        Trace::Record("mult_expr matched");
         return Mul(yap::transform(yap::as_expr(lhs), *this),
                    yap::transform(yap::as_expr(rhs), *this));
     }
 
     template <typename Expr1, typename Expr2>
-    auto operator() (yap::expr_tag<yap::expr_kind::comma>,
+    auto operator() (yap::expr_tag<yap::expr_kind::assign>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("comma_expr matched\n");
-        yap::transform(yap::as_expr(lhs), *this);
-        return yap::transform(yap::as_expr(rhs), *this);
+        Trace::Record("assign_expr matched");
+        return lhs = yap::transform(yap::as_expr(rhs), *this);
+    }
+
+    // Every operand of the sequence but the last is started as a task once
+    // the earlier operands it conflicts with have finished; operands that do
+    // not conflict run concurrently.  The last operand runs on this thread
+    // and its value is the value of the sequence.  All tasks are joined
+    // before returning.
+    template <typename Tuple>
+    auto operator() (yap::expression<yap::expr_kind::comma, Tuple> const &expr) {
+        auto operands = CommaOperands(expr);
+        constexpr std::size_t size = decltype(hana::length(operands))::value;
+        Trace::Record("comma_expr matched");
+
+        std::vector<AccessSets> access;
+        hana::for_each(operands, [&](auto const *operand) {
+            access.emplace_back();
+            yap::transform(*operand, access.back());
+        });
+        auto dependencies = [&](std::size_t i) {
+            std::vector<std::size_t> deps;
+            for (std::size_t j = 0; j < i; ++j) {
+                if (access[i].ConflictsWith(access[j]))
+                    deps.push_back(j);
+            }
+            Trace::Record(deps.empty() ? "comma operand starts at once" : "comma operand waits for earlier conflicting ones");
+            return deps;
+        };
+
+        std::vector<std::shared_future<void>> tasks;
+        hana::for_each(hana::drop_back(operands), [&](auto const *operand) {
+            std::vector<std::shared_future<void>> deps;
+            for (std::size_t j : dependencies(tasks.size()))
+                deps.push_back(tasks[j]);
+            Transformer transformer = *this;
+            tasks.push_back(std::async(std::launch::async, [=]() mutable {
+                for (auto const &dep : deps)
+                    dep.wait();
+                yap::transform(*operand, transformer);
+            }).share());
+        });
+
+        for (std::size_t j : dependencies(size - 1))
+            tasks[j].get();
+        auto result = yap::transform(*hana::back(operands), *this);
+        for (auto const &task : tasks)
+            task.get();
+        return result;
     }
 
     template <typename Cond, typename Then, typename Else>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::call>,
                      IfExpr const & if_expr, Cond && cond_expr, Then && then_expr, Else && else_expr) {
-        std::cout << "If matched" << std::endl;
+        Trace::Record("If matched");
         bool cond = yap::transform(yap::as_expr(cond_expr), *this);
         if (cond) {
-            std::cout << "then_expr transformed" << std::endl;
+            Trace::Record("then_expr transformed");
             return yap::transform(yap::as_expr(then_expr), *this);
         } else {
-            std::cout << "else_expr transformed" << std::endl;
+            Trace::Record("else_expr transformed");
             return yap::transform(yap::as_expr(else_expr), *this);
         }
     }
@@ -110,7 +251,7 @@ struct Transformer {
     template <typename Callable, typename ... Args>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::call>,
                      Callable callable, Args ... args) {
-        std::cout << "Call matched" << std::endl;
+        Trace::Record("Call matched");
         return  callable(yap::transform(yap::as_expr(args), *this)...);
     }
 };
@@ -122,23 +263,33 @@ void TestNumberExpr() {
     auto n2 = Number(1.0);
     auto n3 = Number(2.0);
     auto n4 = Number(3.0);
+    auto n5 = Number(0.0);
     Config config;
 
     auto e1 = yap::make_terminal(n1) + yap::make_terminal(n2);
     auto e2 = yap::make_terminal(n3) + yap::make_terminal(n4);
     auto fn = yap::make_terminal(Inc);
  
+    // Reads n2 and n3 like e1 and e2, and writes n5, which e4 reads: e1, e2 and e3
+    // run concurrently, e4 after e3.
+    auto e3 = (yap::make_terminal(n5) = yap::make_terminal(n2) * yap::make_terminal(n3));
+    // n5 is read here; the Number terminal is a private copy.
+    auto e4 = yap::make_terminal(n5) + yap::make_terminal(Number(10.0));
+
     // auto expr1 = yap::make_expression<yap::expr_kind::comma>(e1, e2);
-    auto expr1 = (e1, e2);
+    auto expr1 = (e1, e2, e3, e4);
     // for_(e1 : range1, e2 : range2, e3 : range3) -> (e1.CopyTo<UBUF>() + e2.CopyTo<UBUF>()).CopyTo<GM>(e3)
 
     std::cout << "- Before transformation:\n";
     yap::print(std::cout, expr1);
 
-    auto expr2 = yap::transform(expr1, Transformer{});
+    auto expr2 = yap::transform(expr1, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
 
     std::cout << "- After transformation:\n";
     std::cout << expr2 << std::endl;
+    // The value of the sequence is e4: n5 = 1 * 2, plus 10.
+    assert(expr2.x == 12);
     // yap::print(std::cout, expr2);
 
     // std::cout << "- Evaluation:\n";
@@ -4,7 +4,17 @@
 #include <boost/hana.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cmath>
+#include <iterator>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "../trace.hpp"
 
 namespace yap = boost::yap;
 namespace hana = boost::hana;
@@ -65,12 +75,317 @@ struct ForExpr {};
 auto aaa = yap::make_terminal(ForExpr{});
 using ForExprType = decltype(aaa());
 
+// Evaluates to hana::true_ if the expression contains a placeholder, i.e.
+// depends on the loop variable of a for_ body.
+struct HasPlaceholder {
+    template <long long I>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, yap::placeholder<I>) {
+        return hana::true_c;
+    }
+
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&) {
+        return hana::false_c;
+    }
+
+    template <yap::expr_kind Kind, typename... Args>
+    auto operator() (yap::expr_tag<Kind>, Args &&... args) {
+        return hana::bool_c<(decltype(yap::transform(yap::as_expr(args), *this))::value || ...)>;
+    }
+};
+
+// A callable marked as free of side effects, so that HoistInvariants may call
+// it once instead of once per element.
+template <typename F>
+struct Pure {
+    F fn;
+
+    template <typename... Args>
+    auto operator() (Args &&... args) const {
+        return fn(std::forward<Args>(args)...);
+    }
+};
+
+template <typename F>
+Pure<F> MakePure(F fn) {
+    return Pure<F>{fn};
+}
+
+template <typename T>
+struct is_pure : std::false_type {};
+
+template <typename F>
+struct is_pure<Pure<F>> : std::true_type {};
+
+// Evaluates to hana::true_ if the expression has a side effect: it calls
+// something not marked Pure, or assigns, compound-assigns, increments or
+// decrements.
+struct HasSideEffect {
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&) {
+        return hana::false_c;
+    }
+
+    template <typename Fn, typename... Args>
+    auto operator() (yap::expr_tag<yap::expr_kind::call>, Fn &&fn, Args &&... args) {
+        constexpr bool pure = is_pure<std::decay_t<decltype(yap::value(yap::as_expr(fn)))>>::value;
+        return hana::bool_c<!pure || (decltype(yap::transform(yap::as_expr(args), *this))::value || ...)>;
+    }
+
+    template <yap::expr_kind Kind, typename... Args>
+    auto operator() (yap::expr_tag<Kind>, Args &&... args) {
+        constexpr bool sideEffect =
+            Kind == yap::expr_kind::pre_inc || Kind == yap::expr_kind::pre_dec ||
+            Kind == yap::expr_kind::post_inc || Kind == yap::expr_kind::post_dec ||
+            (Kind >= yap::expr_kind::assign && Kind <= yap::expr_kind::bitwise_xor_assign);
+        return hana::bool_c<sideEffect || (decltype(yap::transform(yap::as_expr(args), *this))::value || ...)>;
+    }
+};
+
+// Rewrites a loop body so that every largest subexpression without a
+// placeholder is evaluated once, here, and replaced by a terminal holding its
+// value; only the loop-variant part is left to evaluate per element.  A
+// subexpression with a side effect (see HasSideEffect) stays in the loop, so
+// the effect still happens once per element; its operands are still hoisted.
+template <typename Trace = DefaultTrace>
+struct HoistInvariants {
+    template <long long I>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, yap::placeholder<I>) {
+        return yap::make_terminal(yap::placeholder<I>{});
+    }
+
+    // Other terminals are left in place; they live as long as the body.
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&t) {
+        return yap::make_terminal(t);
+    }
+
+    template <yap::expr_kind Kind, typename... Args>
+    auto operator() (yap::expr_tag<Kind>, Args &&... args) {
+        constexpr bool variant = (decltype(yap::transform(yap::as_expr(args), HasPlaceholder{}))::value || ...) ||
+                                 decltype(yap::transform(yap::make_expression<Kind>(yap::as_expr(args)...), HasSideEffect{}))::value;
+        if constexpr (variant) {
+            return yap::make_expression<Kind>(yap::transform(yap::as_expr(args), *this)...);
+        } else {
+            auto invariant = yap::make_expression<Kind>(yap::as_expr(args)...);
+            Trace::Record("Hoisted", TypeName<decltype(invariant)>());
+            return yap::make_terminal(yap::evaluate(invariant));
+        }
+    }
+};
+
+// Evaluates to hana::true_ if the expression contains placeholder I.
+template <long long I>
+struct UsesPlaceholder {
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, yap::placeholder<I>) {
+        return hana::true_c;
+    }
+
+    template <typename T>
+    auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&) {
+        return hana::false_c;
+    }
+
+    template <yap::expr_kind Kind, typename... Args>
+    auto operator() (yap::expr_tag<Kind>, Args &&... args) {
+        return hana::bool_c<(decltype(yap::transform(yap::as_expr(args), *this))::value || ...)>;
+    }
+};
+
+// Reductions a for_ body can be recognized as.  In a body, 1_p is the
+// element and 2_p the accumulator; a body without 2_p is summed, as For2
+// always did.
+enum class ReduceOp { None, Sum, Product, Min, Max };
+
+const char *ReduceOpName(ReduceOp op) {
+    switch (op) {
+        case ReduceOp::Sum: return "sum";
+        case ReduceOp::Product: return "product";
+        case ReduceOp::Min: return "min";
+        case ReduceOp::Max: return "max";
+        default: return "none";
+    }
+}
+
+struct MinFn {
+    template <typename T>
+    T operator() (T a, T b) const { return b < a ? b : a; }
+};
+
+struct MaxFn {
+    template <typename T>
+    T operator() (T a, T b) const { return a < b ? b : a; }
+};
+
+auto min_ = yap::make_terminal(MinFn{});
+auto max_ = yap::make_terminal(MaxFn{});
+
+template <ReduceOp Op, typename T>
+T Combine(T a, T b) {
+    if constexpr (Op == ReduceOp::Sum)
+        return a + b;
+    else if constexpr (Op == ReduceOp::Product)
+        return a * b;
+    else if constexpr (Op == ReduceOp::Min)
+        return MinFn{}(a, b);
+    else
+        return MaxFn{}(a, b);
+}
+
+// The value every fold of a for_ body starts from: the identity of its op, so
+// that an empty range gives it and every accumulator can start from it.  A
+// body that is not a recognized reduction (ReduceOp::None) starts from T(0),
+// as a sum does.
+template <ReduceOp Op, typename T>
+T Identity() {
+    if constexpr (Op == ReduceOp::Sum || Op == ReduceOp::None)
+        return T(0);
+    else if constexpr (Op == ReduceOp::Product)
+        return T(1);
+    else if constexpr (Op == ReduceOp::Min)
+        return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+    else
+        return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+}
+
+// A recognized reduction: acc = Combine<Op>(acc, evaluate(elem, element)).
+template <ReduceOp Op, typename Elem>
+struct Reduction {
+    static constexpr ReduceOp op = Op;
+    Elem elem;
+};
+
+template <ReduceOp Op, typename Expr>
+auto MakeReduction(Expr &&elem) {
+    auto e = yap::as_expr(elem);
+    return Reduction<Op, decltype(e)>{e};
+}
+
+// Matches the root of a for_ body against 2_p + e, e + 2_p, 2_p * e, e * 2_p,
+// min_(2_p, e) and max_(2_p, e), where e does not use 2_p.  Anything else
+// that uses 2_p is ReduceOp::None and is folded serially.
+struct MatchReduction {
+    template <typename T>
+    static constexpr bool IsAccumulator() {
+        return std::is_same<std::decay_t<T>, yap::placeholder<2>>::value;
+    }
+
+    template <typename E>
+    static constexpr bool UsesAccumulator() {
+        return decltype(yap::transform(yap::as_expr(std::declval<E>()), UsesPlaceholder<2>{}))::value;
+    }
+
+    template <ReduceOp Op, typename Acc, typename Elem>
+    static auto Match(Acc &&, Elem &&elem) {
+        if constexpr (IsAccumulator<Acc>() && !UsesAccumulator<Elem>())
+            return MakeReduction<Op>(elem);
+        else
+            return Reduction<ReduceOp::None, int>{};
+    }
+
+    template <typename Expr1, typename Expr2>
+    auto operator() (yap::expr_tag<yap::expr_kind::plus>, Expr1 &&lhs, Expr2 &&rhs) {
+        if constexpr (IsAccumulator<Expr2>())
+            return Match<ReduceOp::Sum>(rhs, lhs);
+        else
+            return Match<ReduceOp::Sum>(lhs, rhs);
+    }
+
+    template <typename Expr1, typename Expr2>
+    auto operator() (yap::expr_tag<yap::expr_kind::multiplies>, Expr1 &&lhs, Expr2 &&rhs) {
+        if constexpr (IsAccumulator<Expr2>())
+            return Match<ReduceOp::Product>(rhs, lhs);
+        else
+            return Match<ReduceOp::Product>(lhs, rhs);
+    }
+
+    template <typename Fn, typename Acc, typename Elem>
+    auto operator() (yap::expr_tag<yap::expr_kind::call>, Fn &&, Acc &&acc, Elem &&elem) {
+        if constexpr (std::is_same<std::decay_t<Fn>, MinFn>::value)
+            return Match<ReduceOp::Min>(acc, elem);
+        else if constexpr (std::is_same<std::decay_t<Fn>, MaxFn>::value)
+            return Match<ReduceOp::Max>(acc, elem);
+        else
+            return Reduction<ReduceOp::None, int>{};
+    }
+
+    template <yap::expr_kind Kind, typename... Args>
+    auto operator() (yap::expr_tag<Kind>, Args &&...) {
+        return Reduction<ReduceOp::None, int>{};
+    }
+};
+
+// How far a floating-point sum or product may be reassociated.  Strict keeps
+// the serial order, and so the result of a plain loop; Relaxed lets the
+// reduction use several accumulators and threads.  Integer reductions and
+// min/max give the same result either way and are always reassociated.
+enum class FloatReduction { Strict, Relaxed };
+
+// Independent accumulators per loop: enough to fill the SIMD registers and
+// hide the add/multiply latency.
+constexpr int kAccumulators = 16;
+
+// Reduces f(x[0]), ..., f(x[n - 1]) with kAccumulators interleaved
+// accumulators, which the compiler keeps in vector registers.
+template <ReduceOp Op, typename E, typename F>
+auto ReduceBlock(const E *x, std::size_t n, F &f) {
+    using T = decltype(f(x[0]));
+    T acc[kAccumulators];
+    for (int k = 0; k < kAccumulators; ++k)
+        acc[k] = Identity<Op, T>();
+    std::size_t i = 0;
+    for (; i + kAccumulators <= n; i += kAccumulators) {
+        for (int k = 0; k < kAccumulators; ++k)
+            acc[k] = Combine<Op>(acc[k], f(x[i + k]));
+    }
+    for (; i < n; ++i)
+        acc[0] = Combine<Op>(acc[0], f(x[i]));
+    T result = acc[0];
+    for (int k = 1; k < kAccumulators; ++k)
+        result = Combine<Op>(result, acc[k]);
+    return result;
+}
+
+// Reduces a contiguous range, split into numThreads blocks whose results are
+// combined in order.
+template <ReduceOp Op, typename E, typename F>
+auto ReduceContiguous(const E *x, std::size_t n, F &f, unsigned numThreads) {
+    using T = decltype(f(x[0]));
+    numThreads = std::max(1u, std::min<unsigned>(numThreads, n / 4096));
+    if (numThreads == 1)
+        return ReduceBlock<Op>(x, n, f);
+    std::vector<T> partial(numThreads);
+    std::vector<std::thread> threads;
+    std::size_t const block = (n + numThreads - 1) / numThreads;
+    for (unsigned t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&, t] {
+            std::size_t const first = std::min(n, t * block);
+            partial[t] = ReduceBlock<Op>(x + first, std::min(n, first + block) - first, f);
+        });
+    }
+    T result = Identity<Op, T>();
+    for (unsigned t = 0; t < numThreads; ++t) {
+        threads[t].join();
+        result = Combine<Op>(result, partial[t]);
+    }
+    return result;
+}
+
+template <typename Range, typename = void>
+struct is_contiguous : std::false_type {};
+
+template <typename Range>
+struct is_contiguous<Range, std::void_t<decltype(std::data(std::declval<Range &>()))>>
+    : std::is_pointer<decltype(std::data(std::declval<Range &>()))> {};
+
+template <typename Trace = DefaultTrace>
 struct Transformer {
+    FloatReduction mFloatReduction = FloatReduction::Strict;
+    unsigned mThreads = 1;
+
     template <typename T>
     auto operator() (yap::expr_tag<yap::expr_kind::terminal>, T &&t) {
-        printf("Terminal matched\n");
-        // PrintTypeName(t);
-        // std::cout << t << std::endl;
+        Trace::Record("Terminal matched");
         // return yap::make_terminal(t);
         return t;
     }
@@ -78,7 +393,7 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::plus>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("plus_expr matched\n");
+        Trace::Record("plus_expr matched");
         return Add(yap::transform(yap::as_expr(lhs), *this),
                    yap::transform(yap::as_expr(rhs), *this));
     }
@@ -86,7 +401,7 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::multiplies>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("mult_expr matched\n");
+        Trace::Record("mult_expr matched");
         return Mul(yap::transform(yap::as_expr(lhs), *this),
                    yap::transform(yap::as_expr(rhs), *this));
     }
@@ -102,7 +417,7 @@ struct Transformer {
     template <typename Expr1, typename Expr2>
     auto operator() (yap::expr_tag<yap::expr_kind::comma>,
                      Expr1 &&lhs, Expr2 &&rhs) {
-        printf("comma_expr matched\n");
+        Trace::Record("comma_expr matched");
         yap::transform(yap::as_expr(lhs), *this);
         return yap::transform(yap::as_expr(rhs), *this);
     }
@@ -110,13 +425,13 @@ struct Transformer {
     template <typename Cond, typename Then, typename Else>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::call>,
                      IfExpr const & if_expr, Cond && cond_expr, Then && then_expr, Else && else_expr) {
-        std::cout << "If matched" << std::endl;
+        Trace::Record("If matched");
         bool cond = yap::transform(yap::as_expr(cond_expr), *this);
         if (cond) {
-            std::cout << "then_expr transformed" << std::endl;
+            Trace::Record("then_expr transformed");
             return yap::transform(yap::as_expr(then_expr), *this);
         } else {
-            std::cout << "else_expr transformed" << std::endl;
+            Trace::Record("else_expr transformed");
             return yap::transform(yap::as_expr(else_expr), *this);
         }
     }
@@ -124,48 +439,70 @@ struct Transformer {
     template <typename Range>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::call>,
                      ForExpr const &forExpr, Range &&range) {
-        std::cout << "For matched" << std::endl;
-        PrintTypeName(range);
-        for (auto i : range) {
-            std::cout << i << std::endl;
-        }
+        Trace::Record("For matched", TypeName<Range>());
         return 0;
     }
 
     template <typename Range, typename Algorithm>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::call>,
                      ForExpr const &forExpr, Range &&range, Algorithm && algo) {
-        std::cout << "For2 matched" << std::endl;
-        std::cout << "forExpr: \n";
-        PrintTypeName(forExpr);
-        std::cout << "range: \n";
-        PrintTypeName(range);
-        std::cout << "algo: \n";
-        PrintTypeName(algo);
-        int sum = 0;
-        for (auto i : range) {
-            // TODO: use transform
-            sum += yap::evaluate(yap::as_expr(algo), i);
-            std::cout << sum << std::endl;
+        Trace::Record("For2 matched");
+        Trace::Record("range:", TypeName<Range>());
+        Trace::Record("algo:", TypeName<Algorithm>());
+        auto body = yap::transform(yap::as_expr(algo), HoistInvariants<Trace>{});
+        Trace::Record("body after hoisting:", TypeName<decltype(body)>());
+
+        if constexpr (!decltype(yap::transform(body, UsesPlaceholder<2>{}))::value) {
+            return Reduce(range, MakeReduction<ReduceOp::Sum>(body));
+        } else {
+            auto reduction = yap::transform(body, MatchReduction{});
+            if constexpr (decltype(reduction)::op != ReduceOp::None) {
+                return Reduce(range, reduction);
+            } else {
+                Trace::Record("reduction: none, folding serially");
+                // The accumulator has the type the body gives when the
+                // element is passed as the accumulator too.
+                using E = std::decay_t<decltype(*std::begin(range))>;
+                using T = std::decay_t<decltype(yap::evaluate(body, std::declval<const E &>(), std::declval<E>()))>;
+                T acc = Identity<ReduceOp::None, T>();
+                for (auto const &x : range)
+                    acc = yap::evaluate(body, x, acc);
+                return acc;
+            }
+        }
+    }
+
+    template <typename Range, ReduceOp Op, typename Elem>
+    auto Reduce(Range &range, const Reduction<Op, Elem> &reduction) {
+        auto f = [&reduction](const auto &x) { return yap::evaluate(reduction.elem, x); };
+        using T = decltype(f(*std::begin(range)));
+        constexpr bool exact = std::is_integral<T>::value || Op == ReduceOp::Min || Op == ReduceOp::Max;
+        bool const reassociate = exact || mFloatReduction == FloatReduction::Relaxed;
+        Trace::Record("reduction:", ReduceOpName(Op));
+        Trace::Record(reassociate ? "vectorized" : "in order");
+        if constexpr (is_contiguous<Range>::value) {
+            if (reassociate)
+                return ReduceContiguous<Op>(std::data(range), std::size(range), f, mThreads);
         }
-        return sum;
+        T acc = Identity<Op, T>();
+        for (auto const &x : range)
+            acc = Combine<Op>(acc, f(x));
+        return acc;
     }
 
     template <typename Callable, typename Body>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::subscript>,
                      Callable && callable,
                      Body && body) {
-        std::cout << "Subscript matched" << std::endl;
-        std::cout << "callable: ";
-        PrintTypeName(callable);
+        Trace::Record("Subscript matched");
+        Trace::Record("callable:", TypeName<Callable>());
         // yap::print(std::cout, callable.elements[1_c]);
         // std::cout << "callable.elements:\n";
         // PrintTypeName(callable.elements);
         // std::cout << "\nForExprType: ";
         // PrintTypeName<ForExprType>();
         // yap::print(std::cout, callable);
-        std::cout << "body\n";
-        PrintTypeName(body);
+        Trace::Record("body", TypeName<Body>());
         auto expr = yap::make_expression<yap::expr_kind::call>(
             callable.elements[0_c],
             callable.elements[1_c],
@@ -177,8 +514,7 @@ struct Transformer {
     template <typename Callable, typename ... Args>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::call>,
                      Callable callable, Args ... args) {
-        std::cout << "Call matched" << std::endl;
-        PrintTypeName(callable);
+        Trace::Record("Call matched", TypeName<Callable>());
         auto x1 = yap::transform(callable, *this);
         return  callable(yap::transform(yap::as_expr(args), *this)...);
     }
@@ -187,6 +523,20 @@ struct Transformer {
 
 int Inc(int i) { return i + 1; }
 
+int gSquares = 0;
+
+int Square(int i) {
+    gSquares++;
+    return i * i;
+}
+
+int gTicks = 0;
+
+int Tick(int i) {
+    gTicks++;
+    return i;
+}
+
 void TestNumberExpr() {
     auto n1 = Number(0.0);
     auto n2 = Number(1.0);
@@ -207,11 +557,12 @@ void TestNumberExpr() {
     // return;
     auto expr1 = foreach_(range1)[1_p];
 
-    PrintTypeName<ForExprType>();
+    std::cout << TypeName<ForExprType>() << "\n";
     std::cout << "- Before transformation:\n";
     yap::print(std::cout, expr1);
 
-    auto expr2 = yap::transform(expr1, Transformer{});
+    auto expr2 = yap::transform(expr1, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
 
     std::cout << "- After transformation:\n";
     std::cout << expr2 << std::endl;
@@ -220,8 +571,101 @@ void TestNumberExpr() {
     // std::cout << "- Evaluation:\n";
     // auto r1 = yap::evaluate(expr2);
     // std::cout << r1 << std::endl;
+
+    // Square(3) * 2 + 1 does not depend on the loop variable and Square is
+    // marked pure: it is evaluated once, before the loop, rather than once
+    // per element.
+    auto square = yap::make_terminal(MakePure(Square));
+    auto expr3 = foreach_(range1)[1_p * (square(3) * 2 + 1) + fn(1_p)];
+    [[maybe_unused]] int squares = gSquares;
+    auto sum = yap::transform(expr3, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
+    std::cout << "- Sum: " << sum << ", Square() called " << gSquares - squares << " times" << std::endl;
+    assert(sum == (1 + 2 + 3) * 19 + (2 + 3 + 4) && gSquares == squares + 1);
+
+    // Tick is not marked pure, so it is called once per element even though
+    // its argument does not depend on the loop variable.
+    auto tick = yap::make_terminal(Tick);
+    auto expr4 = foreach_(range1)[1_p + tick(0)];
+    [[maybe_unused]] int ticks = gTicks;
+    [[maybe_unused]] auto sum4 = yap::transform(expr4, Transformer<>{});
+    DefaultTrace::Dump(std::cout);
+    assert(sum4 == 1 + 2 + 3 && gTicks == ticks + 3);
+
+    // Assignments and increments without a placeholder stay in the loop too.
+    int y = 0;
+    auto y_ = yap::make_terminal(y);
+    [[maybe_unused]] auto sum5 = yap::transform(foreach_(range1)[1_p + (y_ += 1)], Transformer<>{});
+    DefaultTrace::Dump(std::cout);
+    assert(sum5 == (1 + 1) + (2 + 2) + (3 + 3) && y == 3);
+    [[maybe_unused]] auto sum6 = yap::transform(foreach_(range1)[1_p + ++y_], Transformer<>{});
+    DefaultTrace::Dump(std::cout);
+    assert(sum6 == (1 + 4) + (2 + 5) + (3 + 6) && y == 6);
+}
+
+template <typename Fn>
+double TimeMs(Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Reductions over ranges: 1_p is the element and 2_p the accumulator.
+void TestReductions() {
+    std::size_t const n = 1 << 22;
+    std::vector<int> ints(n);
+    std::vector<double> doubles(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        ints[i] = int(i % 1000) - 500;
+        doubles[i] = 1.0 / (1 + i % 977);
+    }
+    auto foreach_ = yap::make_terminal(ForExpr{});
+    auto ints_ = yap::make_terminal(ints);
+    auto doubles_ = yap::make_terminal(doubles);
+
+    int intSum = 0, intMax = 0;
+    double serialMs = TimeMs([&] {
+        for (int x : ints)
+            intSum += x * 3;
+        intMax = *std::max_element(ints.begin(), ints.end());
+    });
+    int sum = 0, max = 0, min = 0;
+    double reducedMs = TimeMs([&] {
+        sum = yap::transform(foreach_(ints_)[2_p + 1_p * 3], Transformer<>{});
+        max = yap::transform(foreach_(ints_)[max_(2_p, 1_p)], Transformer<>{});
+    });
+    min = yap::transform(foreach_(ints_)[min_(2_p, 1_p)], Transformer<>{});
+    assert(sum == intSum && max == intMax && min == -500);
+    DefaultTrace::Dump(std::cout);
+    std::cout << "- int sum " << sum << ", max " << max << ", min " << min
+              << ": plain loops " << serialMs << " ms, for_ reductions " << reducedMs << " ms" << std::endl;
+
+    // A body without 2_p is summed; in order unless relaxed.
+    double expected = 0;
+    for (double x : doubles)
+        expected += x * 2;
+    double strict = 0, relaxed = 0;
+    double strictMs = TimeMs([&] { strict = yap::transform(foreach_(doubles_)[1_p * 2], Transformer<>{}); });
+    Transformer<> relaxedXform{FloatReduction::Relaxed, std::max(1u, std::thread::hardware_concurrency())};
+    double relaxedMs = TimeMs([&] { relaxed = yap::transform(foreach_(doubles_)[1_p * 2], relaxedXform); });
+    assert(strict == expected);
+    assert(std::abs(relaxed - expected) <= 1e-9 * expected);
+    DefaultTrace::Dump(std::cout);
+    std::cout.precision(17);
+    std::cout << "- double sum: strict " << strict << " in " << strictMs << " ms, relaxed " << relaxed
+              << " in " << relaxedMs << " ms" << std::endl;
+
+    // Not a recognized reduction: folded serially.
+    auto small = yap::make_terminal(std::vector<int>{1, 2, 3});
+    [[maybe_unused]] int folded = yap::transform(foreach_(small)[2_p * 2 + 1_p], Transformer<>{});
+    assert(folded == ((0 * 2 + 1) * 2 + 2) * 2 + 3);
+    auto halves = yap::make_terminal(std::vector<double>{0.5, 1.5});
+    [[maybe_unused]] double foldedHalves = yap::transform(foreach_(halves)[2_p * 0.5 + 1_p], Transformer<>{});
+    assert(foldedHalves == (0 * 0.5 + 0.5) * 0.5 + 1.5);
+    DefaultTrace::Dump(std::cout);
 }
 
 int main() {
     TestNumberExpr();
+    TestReductions();
 }
\ No newline at end of file
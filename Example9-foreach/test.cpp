@@ -7,10 +7,23 @@
 #include <boost/yap/expression.hpp>
 
 #include <boost/hana/maximum.hpp>
+#include <boost/hana/transform.hpp>
+#include <boost/hana/unpack.hpp>
 
 #include <boost/yap/print.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <iostream>
+#include <iterator>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "../compile.hpp"
+#include "../trace.hpp"
 
 
 // Look! A transform!  This one transforms the expression tree into the arity
@@ -55,6 +68,7 @@ namespace yap = boost::yap;
 namespace hana = boost::hana;
 using namespace boost::hana::literals;
 
+template <typename Trace = DefaultTrace>
 struct tt
 {
     hana::tuple<int> list;
@@ -65,7 +79,7 @@ struct tt
     template <long long I>
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::terminal>,
                      boost::yap::placeholder<I>)
-    {   std::cout << "placeholder matched\n";
+    {   Trace::Record("placeholder matched");
         auto expr = yap::make_terminal(list[0_c]);
         return expr;
     }
@@ -79,6 +93,8 @@ struct tt
     // }
 };
 
+// Rebinds placeholders by building a new expression with the I-th element of
+// exprList in place of placeholder I; see Compile() for the cheaper way.
 template <typename... ExprList>
 struct PlaceholderReplacement
 {
@@ -90,14 +106,61 @@ struct PlaceholderReplacement
     auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::terminal>,
                      boost::yap::placeholder<I>)
     {
-        static_assert(I <= sizeof...(ExprList), "Too many placeholders");        
-        std::cout << "placeholder matched\n";
+        static_assert(I <= sizeof...(ExprList), "Too many placeholders");
         auto expr = exprList[hana::llong_c<I - 1>];
         return expr;
     }
 };
 
-template <typename... RangeExprs>
+// Turns a loop body into a callable taking the current elements directly,
+// so no expression is rebuilt per element the way PlaceholderReplacement
+// rebuilds one.
+template <typename Expr>
+auto CompileBody(const Expr &expr)
+{
+    return [f = Compile(expr)](auto &&... elems) { f(elems...); };
+}
+
+// Runs body on the elements of ranges at the same position, until the
+// shortest range ends.
+template <typename Body, typename Iters, typename Ends, std::size_t... I>
+void ZipLoop(Body &body, Iters iters, Ends ends, std::index_sequence<I...>)
+{
+    for (; ((std::get<I>(iters) != std::get<I>(ends)) && ...); (++std::get<I>(iters), ...))
+        body(*std::get<I>(iters)...);
+}
+
+template <typename Body, typename... Ranges>
+void ZipSerial(Body &body, Ranges &... ranges)
+{
+    ZipLoop(body, std::make_tuple(std::begin(ranges)...), std::make_tuple(std::end(ranges)...),
+            std::index_sequence_for<Ranges...>{});
+}
+
+// As ZipSerial, but the positions are split into one contiguous block per
+// hardware thread.  body must be safe to run on different positions at once.
+template <typename Body, typename... Ranges>
+void ZipParallel(Body &body, Ranges &... ranges)
+{
+    static_assert((std::is_base_of<std::random_access_iterator_tag,
+                                   typename std::iterator_traits<decltype(std::begin(ranges))>::iterator_category>::value && ...),
+                  "Parallel for_each_range needs random-access ranges");
+    std::size_t const n = std::min({std::size_t(std::end(ranges) - std::begin(ranges))...});
+    std::size_t const numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t const block = (n + numThreads - 1) / numThreads;
+    std::vector<std::thread> threads;
+    for (std::size_t first = 0; first < n; first += block) {
+        std::size_t const last = std::min(first + block, n);
+        threads.emplace_back([&body, first, last, &ranges...] {
+            for (std::size_t i = first; i < last; ++i)
+                body(std::begin(ranges)[i]...);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+}
+
+template <bool Parallel, typename... RangeExprs>
 struct ForEachRangeObject {
     hana::tuple<RangeExprs...> rangeExprs;
 
@@ -105,30 +168,30 @@ struct ForEachRangeObject {
 
     ForEachRangeObject(const RangeExprs &... ranges) : rangeExprs(ranges...) {}
 
+    // Placeholder I of expr is the element of the I-th range.
     template<typename Expr>
-    auto operator[](Expr && expr)
+    void operator[](Expr && expr)
     {
-        std::cout << "operator[] matched\n";
-        yap::print(std::cout, expr);
-        if constexpr (sizeof...(RangeExprs) == 2) {
-            auto &&range1 = yap::value(rangeExprs[0_c]);
-            auto &&range2 = yap::value(rangeExprs[1_c]);
-            for (auto begin1 = range1.begin(), end1 = range1.end(), begin2 = range2.begin(), end2 = range2.end();
-                 begin1 != end1 && begin2 != end2;
-                 begin1++, begin2++) {
-                std::cout << *begin1 << " " << *begin2 << std::endl;
-                auto tpl = hana::make_tuple(yap::make_terminal(*begin1), yap::make_terminal(*begin2));
-                auto expr2 = yap::transform(expr, PlaceholderReplacement(tpl));
-                yap::print(std::cout, expr2);
-                yap::evaluate(expr2);
-            }
-        }
+        auto body = CompileBody(expr);
+        hana::unpack(rangeExprs, [&body](auto &... ranges) {
+            if constexpr (Parallel)
+                ZipParallel(body, yap::value(ranges)...);
+            else
+                ZipSerial(body, yap::value(ranges)...);
+        });
     }
 };
 
 template <typename... Exprs>
 auto for_each_range(const Exprs &... exprs) {
-    return ForEachRangeObject(exprs...);
+    return ForEachRangeObject<false, Exprs...>(exprs...);
+}
+
+// for_each_range() over random-access ranges, with the positions split
+// across threads.
+template <typename... Exprs>
+auto par_for_each_range(const Exprs &... exprs) {
+    return ForEachRangeObject<true, Exprs...>(exprs...);
 }
 
 int main ()
@@ -141,7 +204,11 @@ int main ()
     auto expr_1 = 1_p + 2.0;
 
     yap::print(std::cout, expr_1);
-    auto expr2 = yap::transform(expr_1, tt{});
+    // The result refers to the transform's list, so the transform must
+    // outlive it.
+    tt<> xform;
+    auto expr2 = yap::transform(expr_1, xform);
+    DefaultTrace::Dump(std::cout);
     yap::print(std::cout, expr2);
     auto x = yap::evaluate(expr2);
     std::cout << "x = " << x << std::endl;
@@ -151,7 +218,9 @@ int main ()
     auto const cout = boost::yap::make_terminal(std::cout);
     auto expr_1 = cout << 1_p;
     yap::print(std::cout, expr_1);
-    auto expr_2 = yap::transform(expr_1, tt{});
+    tt<> xform;
+    auto expr_2 = yap::transform(expr_1, xform);
+    DefaultTrace::Dump(std::cout);
     yap::print(std::cout, expr_2);
     std::cout << "evaluate: ";
     yap::evaluate(expr_2);
@@ -168,6 +237,47 @@ int main ()
     std::cout << "After for_each_range: ";
     // yap::print(std::cout, expr_1);
     
+}
+
+{
+    std::size_t const n = 1 << 20;
+    std::vector<double> a(n), b(n), c(n), out(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        a[i] = i;
+        b[i] = 0.5;
+        c[i] = i % 7;
+    }
+    auto const range_a = yap::make_terminal(a);
+    auto const range_b = yap::make_terminal(b);
+    auto const range_c = yap::make_terminal(c);
+    auto const range_out = yap::make_terminal(out);
+    par_for_each_range(range_out, range_a, range_b, range_c)[
+        1_p = 2_p * 3_p + 4_p
+    ];
+    for (std::size_t i = 0; i < n; ++i)
+        assert(out[i] == a[i] * b[i] + c[i]);
+    std::cout << "par_for_each_range: out[" << n - 1 << "] = " << out[n - 1] << std::endl;
+
+    // The same body bound per element three ways.
+    auto const body = 1_p = 2_p * 3_p + 4_p;
+    auto time = [&](char const *name, auto &&run) {
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < n; ++i)
+            run(out[i], a[i], b[i], c[i]);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        for (std::size_t i = 0; i < n; ++i)
+            assert(out[i] == a[i] * b[i] + c[i]);
+        std::cout << name << ": " << ms << " ms" << std::endl;
+    };
+    time("PlaceholderReplacement per element", [&](double &o, double &x, double &y, double &z) {
+        auto tpl = hana::make_tuple(yap::make_terminal(o), yap::make_terminal(x), yap::make_terminal(y), yap::make_terminal(z));
+        yap::evaluate(yap::transform(body, PlaceholderReplacement(tpl)));
+    });
+    time("yap::evaluate(body, elements...)", [&](double &o, double &x, double &y, double &z) {
+        yap::evaluate(body, o, x, y, z);
+    });
+    auto const f = Compile(body);
+    time("Compile(body)(elements...)", f);
 }
     return 0;
 }
@@ -11,9 +11,21 @@
 #include <boost/hana/contains.hpp>
 #include <boost/hana/keys.hpp>
 
+#include <boost/hana/transform.hpp>
+#include <boost/hana/unpack.hpp>
+#include <boost/hana/index_if.hpp>
+#include <boost/hana/equal.hpp>
+#include <boost/hana/optional.hpp>
+
+#include <cassert>
+#include <chrono>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 #include <iostream>
 
+#include "../compile.hpp"
+
 
 // Here, we introduce special let-placeholders, so we can use them along side
 // the normal YAP placeholders without getting them confused.
@@ -107,6 +119,111 @@ auto let(Expr && expr, Exprs &&... exprs)
         std::forward<Exprs>(exprs)...);
 }
 
+// let_once() is a variant of let() that evaluates each initializer exactly
+// once per call, the way Phoenix's let() does, and stores the result in a
+// slot on the stack; the let-placeholders in the body then refer to the
+// slots.  An initializer that evaluates to an lvalue is bound by reference,
+// so the body sees (and can modify) the original object; any other result is
+// moved into a slot of its decayed type.  Wrap an initializer in copy_() to
+// force a copy of an lvalue.  Because the initializers need the arguments,
+// 'let_once(...)[...]' is a function object rather than an expression, called
+// with the arguments that evaluate() would get.  The body must not return a
+// reference into a slot, since the slots die when the call returns.
+
+// Evaluates to a copy of its argument; see copy_ in main().
+struct copy_fn
+{
+    template<typename T>
+    std::decay_t<T> operator()(T && t) const
+    {
+        return std::forward<T>(t);
+    }
+};
+
+template<typename T>
+using let_slot_t = std::conditional_t<
+    std::is_lvalue_reference<T>::value,
+    T,
+    std::remove_cv_t<std::remove_reference_t<T>>>;
+
+// Replaces each let-placeholder bound by let_once() with a terminal that
+// refers to its slot.
+template<typename Keys, typename Slots>
+struct let_slot_transform
+{
+    template<long long I>
+    auto operator()(
+        boost::yap::expr_tag<boost::yap::expr_kind::terminal>,
+        let_placeholder<I> i)
+    {
+        auto const index = boost::hana::index_if(
+            Keys{}, boost::hana::equal.to(boost::hana::llong_c<I>));
+        if constexpr (boost::hana::is_just(index)) {
+            return boost::yap::make_terminal(
+                std::get<std::decay_t<decltype(*index)>::value>(slots_));
+        } else {
+            return boost::yap::make_terminal(i);
+        }
+    }
+
+    Slots & slots_;
+};
+
+template<typename Keys, typename Inits, typename Body>
+struct let_once_function
+{
+    template<typename... T>
+    decltype(auto) operator()(T &&... args) const
+    {
+        return boost::hana::unpack(
+            inits_, [&](auto const &... init) -> decltype(auto) {
+                // Braced initialization evaluates the initializers in order.
+                using slots_t = std::tuple<let_slot_t<decltype(
+                    boost::yap::evaluate(init, args...))>...>;
+                slots_t slots{boost::yap::evaluate(init, args...)...};
+                return boost::yap::evaluate(
+                    boost::yap::transform(
+                        body_, let_slot_transform<Keys, slots_t>{slots}),
+                    args...);
+            });
+    }
+
+    Inits inits_;
+    Body body_;
+};
+
+template<typename Keys, typename Inits>
+struct let_once_result
+{
+    template<typename Expr>
+    auto operator[](Expr && expr)
+    {
+        auto body = boost::yap::as_expr(std::forward<Expr>(expr));
+        return let_once_function<Keys, Inits, decltype(body)>{inits_, body};
+    }
+
+    Inits inits_;
+};
+
+// Takes N > 0 expressions of the form 'placeholder = expr', and returns an
+// object with an overloaded operator[]().
+template<typename... Exprs>
+auto let_once(Exprs &&... exprs)
+{
+    static_assert(
+        ((std::remove_reference_t<Exprs>::kind == boost::yap::expr_kind::assign) && ...),
+        "Expressions passed to let_once() must be of the form placeholder = Expression");
+    using keys_t = boost::hana::tuple<boost::hana::llong<
+        std::remove_reference_t<decltype(boost::yap::value(boost::yap::left(exprs)))>::value>...>;
+    auto inits = boost::hana::make_tuple(boost::yap::right(exprs)...);
+    return let_once_result<keys_t, decltype(inits)>{inits};
+}
+
+// Compile() from compile.hpp turns an expression into a function object
+// once, so that calling it with new arguments only evaluates.  A function
+// compiled from 'let(...)[...]' binds the let-placeholders in the same
+// macro-substitution way evaluate() does.
+
 int main()
 {
     // Some handy terminals -- the _a and _b let-placeholders and std::cout as
@@ -173,5 +290,110 @@ int main()
     }
 
     std::cout << "\n";
+
+    auto const copy_ = boost::yap::make_terminal(copy_fn{});
+
+    // With let_once(), '1_p << 3' is evaluated once: this prints "312".
+    {
+        let_once(_a = 1_p << 3)[_a << "1", _a << "2"](std::cout);
+        std::cout << "\n";
+    }
+
+    // _a refers to i, so this prints "0 0" as let() does; copy_() binds a
+    // copy instead, and this prints "0 1".
+    {
+        int i = 1;
+        let_once(_a = 1_p)[cout << --_a << ' '](i);
+        std::cout << i << std::endl;
+
+        int j = 1;
+        let_once(_a = copy_(1_p))[cout << --_a << ' '](j);
+        std::cout << j << std::endl;
+    }
+
+    // Results that are not lvalues are moved into their slots.
+    {
+        auto const make_vector = boost::yap::make_terminal(
+            [](int n) { return std::vector<int>(n, 1); });
+        auto const size = boost::yap::make_terminal(
+            [](std::vector<int> const & v) { return v.size(); });
+        auto f = let_once(_a = make_vector(1_p), _b = 2_p)[size(_a) + _b];
+        assert(f(3, 4) == 7);
+    }
+
+    // An expensive initializer used four times in the body.
+    {
+        int calls = 0;
+        auto const expensive = boost::yap::make_terminal([&calls](int x) {
+            ++calls;
+            double r = x;
+            for (int k = 0; k < 1000; ++k)
+                r = r * 0.999 + 1.0;
+            return r;
+        });
+        int const n = 1 << 14;
+        double sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i)
+            sum += boost::yap::evaluate(let(_a = expensive(1_p))[_a * _a + _a - _a], i);
+        double substituted = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - start).count();
+        int const substituted_calls = calls;
+
+        calls = 0;
+        double once_sum = 0;
+        auto f = let_once(_a = expensive(1_p))[_a * _a + _a - _a];
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i)
+            once_sum += f(i);
+        double once = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start).count();
+
+        assert(sum == once_sum);
+        // let() substitutes expensive(1_p) for each of the four uses of _a;
+        // let_once() evaluates it once per call.
+        assert(substituted_calls == 4 * n);
+        assert(calls == n);
+        std::cout << n << " calls: let() " << substituted_calls << " evaluations, "
+                  << substituted << " ms; let_once() " << calls << " evaluations, "
+                  << once << " ms\n";
+    }
+
+    // Compiled once, the let() expressions above behave the same.
+    {
+        auto f = Compile(let(_a = 1_p, _b = 2_p)[_a * 10 + _b]);
+        assert(f(4, 2) == 42);
+        assert(f(1, 1) == 11);
+
+        int i = 1;
+        Compile(let(_a = 1_p)[cout << --_a << ' '])(i);
+        std::cout << i << std::endl;
+
+        Compile(let(_a = 1_p << 3)[_a << "1", _a << "2"])(std::cout);
+        std::cout << "\n";
+    }
+
+    // Rebinding by transform on every call, against compiling once.
+    {
+        int const n = 1 << 22;
+        long long sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i)
+            sum += boost::yap::evaluate(let(_a = 1_p * 3)[_a * _a + _a], i);
+        double transformed = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - start).count();
+
+        long long compiled_sum = 0;
+        auto f = Compile(let(_a = 1_p * 3)[_a * _a + _a]);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i)
+            compiled_sum += f(i);
+        double compiled = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start).count();
+
+        assert(sum == compiled_sum);
+        std::cout << n << " calls: let() on each call " << transformed
+                  << " ms, compiled once " << compiled << " ms\n";
+    }
 }
 //]
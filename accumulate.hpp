@@ -0,0 +1,90 @@
+#ifndef YAP_EXAMPLES_ACCUMULATE_HPP
+#define YAP_EXAMPLES_ACCUMULATE_HPP
+
+// Lowering an expression to a list of IRs, one node at a time.
+//
+// Accumulating the IRs with hana::append builds a new tuple type at every node
+// and copies everything accumulated so far into it, so both instantiations and
+// copies grow quadratically with the size of the expression.  LowerToIRs()
+// walks the expression once, in continuation-passing style instead: a node
+// makes its IR as a local and calls the continuation of its parent with
+// references to it and to the IRs made before it.  Every IR stays where it was
+// made until the continuation of the root moves it, once, into the result
+// tuple, which is returned back through the chain by guaranteed copy elision.
+// Each node instantiates a fixed number of functions; only their parameter
+// lists grow with the number of IRs made so far.
+
+#include <boost/hana/append.hpp>
+#include <boost/hana/integral_constant.hpp>
+#include <boost/hana/size.hpp>
+#include <boost/hana/tuple.hpp>
+#include <boost/hana/unpack.hpp>
+#include <boost/yap/expression.hpp>
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+template <long long I, std::size_t N, typename Gen, typename Call, typename Args, typename K, typename ...IRs>
+auto LowerCallArgs(Gen &gen, Call &&call, Args &args, K const &k, IRs &...irs);
+
+// Lowers expr, whose temps are numbered from I, and calls
+// k(hana::llong_c<next I>, operand holding the result of expr, irs..., IRs of expr...).
+template <long long I, typename Gen, typename Expr, typename K, typename ...IRs>
+auto LowerNode(Gen &gen, Expr &&expr, K const &k, IRs &...irs) {
+    constexpr boost::yap::expr_kind kind = std::decay_t<Expr>::kind;
+    if constexpr (kind == boost::yap::expr_kind::expr_ref) {
+        return LowerNode<I>(gen, boost::yap::deref(expr), k, irs...);
+    } else if constexpr (kind == boost::yap::expr_kind::terminal) {
+        auto operand = gen.Operand(boost::yap::value(expr));
+        return k(boost::hana::llong_c<I>, operand, irs...);
+    } else if constexpr (kind == boost::yap::expr_kind::call) {
+        auto noArgs = boost::hana::make_tuple();
+        return LowerCallArgs<I, 1>(gen, expr, noArgs, k, irs...);
+    } else {
+        return LowerNode<I>(gen, boost::yap::left(expr), [&](auto i, auto &lhs, auto &...lhsIRs) {
+            return LowerNode<decltype(i)::value>(gen, boost::yap::right(expr), [&](auto j, auto &rhs, auto &...rhsIRs) {
+                constexpr long long J = decltype(j)::value;
+                auto ir = gen.template Binary<J, kind>(std::move(lhs), std::move(rhs));
+                auto result = gen.template Temp<J>();
+                return k(boost::hana::llong_c<J + 1>, result, rhsIRs..., ir);
+            }, lhsIRs...);
+        }, irs...);
+    }
+}
+
+// Lowers the arguments of call from the N-th element on, collecting their
+// operands in args, and then the call itself.  args is bounded by the arity
+// of the call, so appending to it does not grow with the expression.
+template <long long I, std::size_t N, typename Gen, typename Call, typename Args, typename K, typename ...IRs>
+auto LowerCallArgs(Gen &gen, Call &&call, Args &args, K const &k, IRs &...irs) {
+    if constexpr (N == decltype(boost::hana::size(call.elements))::value) {
+        auto ir = boost::hana::unpack(std::move(args), [&](auto &&...operands) {
+            return gen.template Call<I>(boost::yap::value(call.elements[boost::hana::size_c<0>]),
+                                        std::move(operands)...);
+        });
+        auto result = gen.template Temp<I>();
+        return k(boost::hana::llong_c<I + 1>, result, irs..., ir);
+    } else {
+        return LowerNode<I>(gen, call.elements[boost::hana::size_c<N>], [&](auto i, auto &arg, auto &...argIRs) {
+            auto moreArgs = boost::hana::append(std::move(args), std::move(arg));
+            return LowerCallArgs<decltype(i)::value, N + 1>(gen, call, moreArgs, k, argIRs...);
+        }, irs...);
+    }
+}
+
+// Lowers expr and returns its IRs, in execution order, as a hana::tuple.  gen
+// makes the pieces; its temps are numbered from 1 in execution order:
+//   gen.Operand(value)                 the operand of a terminal holding value
+//   gen.template Temp<I>()             the operand that reads temp I
+//   gen.template Binary<I, Kind>(l, r) the IR computing temp I = l Kind r
+//   gen.template Call<I>(f, args...)   the IR computing temp I = f(args...)
+// The operands passed to Binary and Call are rvalues.
+template <typename Gen, typename Expr>
+auto LowerToIRs(Gen &gen, Expr &&expr) {
+    return LowerNode<1>(gen, expr, [](auto, auto &, auto &...irs) {
+        return boost::hana::make_tuple(std::move(irs)...);
+    });
+}
+
+#endif
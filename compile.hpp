@@ -0,0 +1,162 @@
+#ifndef YAP_EXAMPLES_COMPILE_HPP
+#define YAP_EXAMPLES_COMPILE_HPP
+
+// Compile() turns a placeholder expression into a function object once, so
+// that running it on new arguments only evaluates.  Each node becomes a lambda
+// that calls its children's lambdas; placeholder I becomes a lambda that
+// returns its I-th argument directly, and any other terminal is copied into
+// the lambda that returns it, keeping references as references.
+
+#include <boost/hana/transform.hpp>
+#include <boost/hana/unpack.hpp>
+#include <boost/yap/expression.hpp>
+
+#include <tuple>
+#include <type_traits>
+
+template <typename T>
+struct IsPlaceholder : std::false_type {};
+
+template <long long I>
+struct IsPlaceholder<boost::yap::placeholder<I>> : std::true_type {};
+
+// Applies the unary operator Kind to an evaluated operand.
+template <boost::yap::expr_kind Kind, typename T>
+decltype(auto) ApplyUnary(T &&t) {
+    using boost::yap::expr_kind;
+    if constexpr (Kind == expr_kind::unary_plus) return +t;
+    else if constexpr (Kind == expr_kind::negate) return -t;
+    else if constexpr (Kind == expr_kind::dereference) return *t;
+    else if constexpr (Kind == expr_kind::complement) return ~t;
+    else if constexpr (Kind == expr_kind::address_of) return &t;
+    else if constexpr (Kind == expr_kind::logical_not) return !t;
+    else if constexpr (Kind == expr_kind::pre_inc) return ++t;
+    else if constexpr (Kind == expr_kind::pre_dec) return --t;
+    else if constexpr (Kind == expr_kind::post_inc) return t++;
+    else return t--;
+}
+
+// Applies the binary operator Kind to evaluated operands.  The
+// short-circuiting operators and comma are handled by CompileXform,
+// since their right operand must not be evaluated first.
+template <boost::yap::expr_kind Kind, typename T, typename U>
+decltype(auto) ApplyBinary(T &&t, U &&u) {
+    using boost::yap::expr_kind;
+    if constexpr (Kind == expr_kind::shift_left) return t << u;
+    else if constexpr (Kind == expr_kind::shift_right) return t >> u;
+    else if constexpr (Kind == expr_kind::multiplies) return t * u;
+    else if constexpr (Kind == expr_kind::divides) return t / u;
+    else if constexpr (Kind == expr_kind::modulus) return t % u;
+    else if constexpr (Kind == expr_kind::plus) return t + u;
+    else if constexpr (Kind == expr_kind::minus) return t - u;
+    else if constexpr (Kind == expr_kind::less) return t < u;
+    else if constexpr (Kind == expr_kind::greater) return t > u;
+    else if constexpr (Kind == expr_kind::less_equal) return t <= u;
+    else if constexpr (Kind == expr_kind::greater_equal) return t >= u;
+    else if constexpr (Kind == expr_kind::equal_to) return t == u;
+    else if constexpr (Kind == expr_kind::not_equal_to) return t != u;
+    else if constexpr (Kind == expr_kind::bitwise_and) return t & u;
+    else if constexpr (Kind == expr_kind::bitwise_or) return t | u;
+    else if constexpr (Kind == expr_kind::bitwise_xor) return t ^ u;
+    else if constexpr (Kind == expr_kind::assign) return t = u;
+    else if constexpr (Kind == expr_kind::shift_left_assign) return t <<= u;
+    else if constexpr (Kind == expr_kind::shift_right_assign) return t >>= u;
+    else if constexpr (Kind == expr_kind::multiplies_assign) return t *= u;
+    else if constexpr (Kind == expr_kind::divides_assign) return t /= u;
+    else if constexpr (Kind == expr_kind::modulus_assign) return t %= u;
+    else if constexpr (Kind == expr_kind::plus_assign) return t += u;
+    else if constexpr (Kind == expr_kind::minus_assign) return t -= u;
+    else if constexpr (Kind == expr_kind::bitwise_and_assign) return t &= u;
+    else if constexpr (Kind == expr_kind::bitwise_or_assign) return t |= u;
+    else if constexpr (Kind == expr_kind::bitwise_xor_assign) return t ^= u;
+    else if constexpr (Kind == expr_kind::subscript) return t[u];
+    else {
+        static_assert(Kind == expr_kind::shift_left, "Operator not supported by Compile()");
+    }
+}
+
+// Returns the lambda an expression compiles to.  The lambdas take the
+// arguments as lvalues.
+struct CompileXform {
+    template <boost::yap::expr_kind Kind, typename Tuple>
+    auto operator()(boost::yap::expression<Kind, Tuple> const &expr) const {
+        using boost::yap::expr_kind;
+        using namespace boost::hana::literals;
+        if constexpr (Kind == expr_kind::terminal) {
+            using value_type = std::remove_cv_t<
+                std::remove_reference_t<decltype(boost::yap::value(expr))>>;
+            if constexpr (IsPlaceholder<value_type>::value) {
+                return [](auto &... args) -> decltype(auto) {
+                    return std::get<value_type::value - 1>(std::tie(args...));
+                };
+            } else {
+                return [expr](auto &...) -> decltype(auto) {
+                    return boost::yap::value(expr);
+                };
+            }
+        } else if constexpr (Kind == expr_kind::if_else) {
+            auto c = Compile(boost::yap::cond(expr));
+            auto t = Compile(boost::yap::then(expr));
+            auto e = Compile(boost::yap::else_(expr));
+            return [c, t, e](auto &... args) -> decltype(auto) {
+                return c(args...) ? t(args...) : e(args...);
+            };
+        } else if constexpr (Kind == expr_kind::call) {
+            auto children = boost::hana::transform(
+                expr.elements, [this](auto const &child) { return Compile(child); });
+            return [children](auto &... args) -> decltype(auto) {
+                return boost::hana::unpack(
+                    children, [&](auto const &f, auto const &... xs) -> decltype(auto) {
+                        return f(args...)(xs(args...)...);
+                    });
+            };
+        } else if constexpr (boost::yap::detail::arity_of<Kind>() == boost::yap::detail::expr_arity::one) {
+            auto x = Compile(boost::yap::get(expr, 0_c));
+            return [x](auto &... args) -> decltype(auto) {
+                return ApplyUnary<Kind>(x(args...));
+            };
+        } else {
+            auto l = Compile(boost::yap::left(expr));
+            auto r = Compile(boost::yap::right(expr));
+            if constexpr (Kind == expr_kind::logical_and) {
+                return [l, r](auto &... args) -> decltype(auto) { return l(args...) && r(args...); };
+            } else if constexpr (Kind == expr_kind::logical_or) {
+                return [l, r](auto &... args) -> decltype(auto) { return l(args...) || r(args...); };
+            } else if constexpr (Kind == expr_kind::comma) {
+                return [l, r](auto &... args) -> decltype(auto) { return (l(args...), r(args...)); };
+            } else {
+                return [l, r](auto &... args) -> decltype(auto) {
+                    // The left operand is evaluated first, as evaluate() does.
+                    decltype(auto) x = l(args...);
+                    return ApplyBinary<Kind>(static_cast<decltype(x) &&>(x), r(args...));
+                };
+            }
+        }
+    }
+
+    template <typename Expr>
+    auto Compile(Expr const &expr) const {
+        return boost::yap::transform(boost::yap::as_expr(expr), *this);
+    }
+};
+
+// The function object returned by Compile().
+template <typename F>
+struct CompiledExpression {
+    template <typename... T>
+    decltype(auto) operator()(T &&... args) const {
+        return f(args...);
+    }
+
+    F f;
+};
+
+// Compiles expr once into a function object; Compile(expr)(args...) has the
+// value of boost::yap::evaluate(expr, args...).
+template <typename Expr>
+auto Compile(Expr const &expr) {
+    auto f = CompileXform{}.Compile(expr);
+    return CompiledExpression<decltype(f)>{f};
+}
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef YAP_EXAMPLES_SIMPLIFY_HPP
+#define YAP_EXAMPLES_SIMPLIFY_HPP
+
+// Simplify(), the constant-folding pre-pass that the GenIR examples run
+// before lowering an expression.
+
+#include <boost/hana/integral_constant.hpp>
+#include <boost/hana/tuple.hpp>
+#include <boost/yap/expression.hpp>
+
+#include <type_traits>
+#include <utility>
+
+// Compile-time constants are hana integral constants such as 3_c.  Terminals
+// holding an arithmetic value (e.g. the 2 in a * 2) are literals, known only
+// at runtime.  Terminals holding a reference are variables.
+template <typename T>
+struct is_constant : std::false_type {};
+
+template <typename T, T V>
+struct is_constant<boost::hana::integral_constant<T, V>> : std::true_type {};
+
+template <typename Expr>
+struct terminal_value { using type = void; };
+
+template <typename T>
+struct terminal_value<boost::yap::expression<boost::yap::expr_kind::terminal, boost::hana::tuple<T>>> { using type = T; };
+
+template <typename Expr>
+using terminal_value_t = typename terminal_value<std::decay_t<Expr>>::type;
+
+template <typename Expr>
+constexpr bool IsConstant() { return is_constant<terminal_value_t<Expr>>::value; }
+
+template <typename Expr>
+constexpr bool IsLiteral() { return IsConstant<Expr>() || std::is_arithmetic<terminal_value_t<Expr>>::value; }
+
+template <typename Expr, long long V>
+constexpr bool IsConstantEqual() {
+    if constexpr (IsConstant<Expr>())
+        return terminal_value_t<Expr>::value == V;
+    else
+        return false;
+}
+
+template <typename Expr>
+constexpr long long Log2OfConstant() {
+    if constexpr (IsConstant<Expr>()) {
+        constexpr long long v = terminal_value_t<Expr>::value;
+        if constexpr (v > 1 && (v & (v - 1)) == 0) {
+            long long k = 0;
+            while ((1ll << k) != v)
+                k++;
+            return k;
+        }
+    }
+    return -1;
+}
+
+template <typename Expr>
+constexpr bool IsIntegralVariable() {
+    using T = terminal_value_t<Expr>;
+    return std::is_reference<T>::value && std::is_integral<std::remove_reference_t<T>>::value;
+}
+
+// A scalar computed without calls: dropping it, as x * 0 does, changes neither
+// the shape of the result nor any side effect.
+template <typename Expr>
+struct is_plain_scalar : std::false_type {};
+
+template <typename T>
+struct is_plain_scalar<boost::yap::expression<boost::yap::expr_kind::terminal, boost::hana::tuple<T>>>
+    : std::integral_constant<bool, is_constant<std::decay_t<T>>::value || std::is_arithmetic<std::decay_t<T>>::value> {};
+
+template <boost::yap::expr_kind Kind, typename L, typename R>
+struct is_plain_scalar<boost::yap::expression<Kind, boost::hana::tuple<L, R>>>
+    : std::integral_constant<bool, Kind != boost::yap::expr_kind::call &&
+                                   is_plain_scalar<std::decay_t<L>>::value && is_plain_scalar<std::decay_t<R>>::value> {};
+
+template <typename Expr>
+constexpr bool IsPlainScalar() { return is_plain_scalar<std::decay_t<Expr>>::value; }
+
+template <boost::yap::expr_kind Kind, typename L, typename R>
+constexpr auto ApplyOp(L const &l, R const &r) {
+    if constexpr (Kind == boost::yap::expr_kind::plus)
+        return l + r;
+    else
+        return l * r;
+}
+
+// A compile-time constant left in the expression becomes a literal, so that
+// the passes after GenIR only ever see arithmetic values.
+template <typename Expr>
+auto ToRuntime(Expr &&expr) {
+    if constexpr (IsConstant<Expr>()) {
+        auto value = terminal_value_t<Expr>::value;
+        return boost::yap::make_terminal(std::move(value));
+    } else {
+        return expr;
+    }
+}
+
+// Simplifies lhs op rhs, whose operands are already simplified.
+template <boost::yap::expr_kind Kind, typename L, typename R>
+auto SimplifyBinary(L &&lhs, R &&rhs) {
+    constexpr bool add = Kind == boost::yap::expr_kind::plus;
+    constexpr bool mul = Kind == boost::yap::expr_kind::multiplies;
+    if constexpr ((add || mul) && IsConstant<L>() && IsConstant<R>()) {
+        // Folded at compile time: the result is another integral constant
+        return boost::yap::make_terminal(ApplyOp<Kind>(boost::yap::value(lhs), boost::yap::value(rhs)));
+    } else if constexpr ((add || mul) && IsLiteral<L>() && IsLiteral<R>()) {
+        // Folded at runtime
+        auto value = ApplyOp<Kind>(+boost::yap::value(lhs), +boost::yap::value(rhs));
+        return boost::yap::make_terminal(std::move(value));
+    } else if constexpr (mul && IsConstantEqual<L, 0>() && IsPlainScalar<R>()) {
+        return lhs;
+    } else if constexpr (mul && IsConstantEqual<R, 0>() && IsPlainScalar<L>()) {
+        return rhs;
+    } else if constexpr ((mul && IsConstantEqual<L, 1>()) || (add && IsConstantEqual<L, 0>())) {
+        return rhs;
+    } else if constexpr ((mul && IsConstantEqual<R, 1>()) || (add && IsConstantEqual<R, 0>())) {
+        return lhs;
+    } else if constexpr (mul && IsIntegralVariable<L>() && Log2OfConstant<R>() > 0) {
+        return boost::yap::make_expression<boost::yap::expr_kind::shift_left>(ToRuntime(lhs), boost::yap::make_terminal(int(Log2OfConstant<R>())));
+    } else if constexpr (mul && IsIntegralVariable<R>() && Log2OfConstant<L>() > 0) {
+        return boost::yap::make_expression<boost::yap::expr_kind::shift_left>(ToRuntime(rhs), boost::yap::make_terminal(int(Log2OfConstant<L>())));
+    } else {
+        return boost::yap::make_expression<Kind>(ToRuntime(lhs), ToRuntime(rhs));
+    }
+}
+
+// A pre-pass for GenIR: folds constant subtrees and applies x * 1, x + 0 and,
+// when x is a plain scalar, x * 0 (ignoring NaN and infinity), and turns
+// multiplications of integer variables by powers of two into shifts.  Only
+// compile-time constants can remove nodes; literals are folded at runtime when
+// both operands are literals.
+struct SimplifyXform {
+    template <typename T>
+    auto operator() (boost::yap::expression<boost::yap::expr_kind::terminal, boost::hana::tuple<T>> const &expr) {
+        return expr;
+    }
+
+    template <boost::yap::expr_kind Kind, typename Expr1, typename Expr2,
+              typename = std::enable_if_t<Kind == boost::yap::expr_kind::plus || Kind == boost::yap::expr_kind::multiplies>>
+    auto operator() (boost::yap::expression<Kind, boost::hana::tuple<Expr1, Expr2>> const &expr) {
+        return SimplifyBinary<Kind>(boost::yap::transform(boost::yap::left(expr), *this),
+                                    boost::yap::transform(boost::yap::right(expr), *this));
+    }
+};
+
+// The result always has an operation at its root: GenIR lowers a bare
+// terminal to no IR at all, so an expression that simplifies to a terminal x
+// is returned as x + 0.
+template <typename Expr>
+auto Simplify(Expr &&expr) {
+    auto simplified = boost::yap::transform(boost::yap::as_expr(expr), SimplifyXform{});
+    if constexpr (decltype(simplified)::kind == boost::yap::expr_kind::terminal)
+        return boost::yap::make_expression<boost::yap::expr_kind::plus>(ToRuntime(simplified), boost::yap::make_terminal(0));
+    else
+        return simplified;
+}
+
+#endif
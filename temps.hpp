@@ -0,0 +1,116 @@
+#ifndef YAP_EXAMPLES_TEMPS_HPP
+#define YAP_EXAMPLES_TEMPS_HPP
+
+// The temps of the IR lists in Examples 13-15: their placeholder, their
+// liveness, and the pool their buffers come from.
+
+#include <boost/hana/for_each.hpp>
+#include <boost/hana/integral_constant.hpp>
+#include <boost/yap/expression.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <vector>
+
+// A placeholder for temporary variables
+template <long long I>
+struct temp_placeholder : boost::hana::llong<I> {
+    friend std::ostream& operator<< (std::ostream& os, const temp_placeholder<I> &) {
+        os << "temp" << I;
+        return os;
+    }
+};
+
+// Records the temps an expression reads.
+struct CollectTempUses {
+    std::vector<long long> mTemps;
+
+    template <long long J>
+    auto operator() (boost::yap::expr_tag<boost::yap::expr_kind::terminal>, temp_placeholder<J> const &) {
+        mTemps.push_back(J);
+        return 0;
+    }
+};
+
+// Liveness of the temps in an IR list: IR k defines temp mDefs[k] and is the
+// last IR to read the temps in mDying[k].  A temp no IR reads (the result)
+// never dies.
+struct Liveness {
+    std::vector<long long> mDefs;
+    std::vector<std::vector<long long>> mDying;
+};
+
+template <typename Sequence>
+Liveness ComputeLiveness(const Sequence &irList) {
+    Liveness live;
+    std::map<long long, std::size_t> lastUse;
+    boost::hana::for_each(irList, [&](auto const &ir) {
+        std::size_t k = live.mDefs.size();
+        live.mDefs.push_back(boost::yap::value(boost::yap::left(ir)));
+        CollectTempUses uses;
+        boost::yap::transform(boost::yap::right(ir), uses);
+        for (auto temp : uses.mTemps)
+            lastUse[temp] = k;
+    });
+    live.mDying.resize(live.mDefs.size());
+    for (auto const &[temp, k] : lastUse)
+        live.mDying[k].push_back(temp);
+    return live;
+}
+
+// Hands out the buffers of temps.  A temp's buffer goes back to the pool after
+// the last IR reading it and is reused by a later temp that fits in it, so
+// temps whose lifetimes do not overlap share a buffer.  A buffer is handed out
+// by copy, so copies of a Buffer must share its storage.
+template <typename Buffer>
+struct BufferPool {
+    std::vector<Buffer> mBuffers;            // Every buffer allocated so far
+    std::vector<std::size_t> mSizes;         // Elements in each of mBuffers
+    std::vector<std::size_t> mFree;          // Indices into mBuffers
+    std::map<long long, std::size_t> mInUse; // Temp => index into mBuffers
+    std::size_t mTemps = 0;
+    std::size_t mNaiveElements = 0;          // With one buffer per temp
+
+    // A buffer of at least n elements for temp.  make(id, n) allocates a new
+    // one when no free buffer is large enough.
+    template <typename Make>
+    Buffer Acquire(long long temp, std::size_t n, Make &&make) {
+        mTemps++;
+        mNaiveElements += n;
+        // Best fit: the smallest free buffer that is large enough
+        auto best = mFree.end();
+        for (auto it = mFree.begin(); it != mFree.end(); ++it) {
+            if (mSizes[*it] >= n && (best == mFree.end() || mSizes[*it] < mSizes[*best]))
+                best = it;
+        }
+        std::size_t index = mBuffers.size();
+        if (best != mFree.end()) {
+            index = *best;
+            mFree.erase(best);
+        } else {
+            mBuffers.push_back(make(int(index + 1), n));
+            mSizes.push_back(n);
+        }
+        mInUse[temp] = index;
+        return mBuffers[index];
+    }
+
+    void Release(long long temp) {
+        auto it = mInUse.find(temp);
+        assert(it != mInUse.end());
+        mFree.push_back(it->second);
+        mInUse.erase(it);
+    }
+
+    // Elements in all the buffers allocated so far
+    std::size_t Elements() const {
+        std::size_t n = 0;
+        for (auto size : mSizes)
+            n += size;
+        return n;
+    }
+};
+
+#endif
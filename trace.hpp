@@ -0,0 +1,102 @@
+#ifndef YAP_EXAMPLES_TRACE_HPP
+#define YAP_EXAMPLES_TRACE_HPP
+
+// Trace policies for the transforms in the examples.  A transform takes the
+// policy as a template parameter and reports every node it matches with
+// Trace::Record(what, detail).  Both arguments must be string literals (or
+// otherwise outlive the trace), since only the pointers are kept.
+//
+// NoTrace::Record() is empty, so with NDEBUG the transforms carry no
+// tracing code at all.  Otherwise RingTrace keeps the last kCapacity records
+// in a lock-free ring buffer, which Dump() prints on demand.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// The part of a __PRETTY_FUNCTION__ naming the template argument T, e.g.
+// "Number&" out of "... TypeName() [with T = Number&]" (GCC) or
+// "... TypeName() [T = Number &]" (Clang).
+inline std::string TemplateArgOf(std::string const &pretty) {
+    std::size_t const begin = pretty.find("T = ") + 4;
+    return pretty.substr(begin, pretty.rfind(']') - begin);
+}
+
+// The name of T, as spelled by the compiler.  The string lives until the
+// program exits, so it can be recorded in a trace.
+template <typename T>
+char const * TypeName() {
+    static std::string const name = TemplateArgOf(__PRETTY_FUNCTION__);
+    return name.c_str();
+}
+
+struct NoTrace {
+    static void Record(char const *, char const * = nullptr) {}
+    static void Dump(std::ostream &) {}
+};
+
+struct TraceEntry {
+    std::atomic<std::uint64_t> mSeq{0};
+    std::atomic<char const *> mWhat{nullptr};
+    std::atomic<char const *> mDetail{nullptr};
+};
+
+struct RingTrace {
+    static constexpr std::uint64_t kCapacity = 4096;
+
+    // Any number of threads may record at once.  A record only claims a
+    // slot and writes it; nothing waits.
+    static void Record(char const *what, char const *detail = nullptr) {
+        std::uint64_t const index = sHead.fetch_add(1, std::memory_order_relaxed);
+        TraceEntry &entry = sEntries[index % kCapacity];
+        // An odd sequence number marks the slot as being written.  A reader
+        // that sees one of the new fields also sees the odd number.
+        entry.mSeq.store(2 * index + 1, std::memory_order_relaxed);
+        entry.mWhat.store(what, std::memory_order_release);
+        entry.mDetail.store(detail, std::memory_order_release);
+        entry.mSeq.store(2 * index + 2, std::memory_order_release);
+    }
+
+    // Prints the records made since the previous Dump(), oldest first, and
+    // says how many were overwritten before they could be printed.  Only one
+    // thread may dump at a time.
+    static void Dump(std::ostream &os) {
+        std::uint64_t const head = sHead.load(std::memory_order_acquire);
+        std::uint64_t first = sTail;
+        if (head - first > kCapacity) {
+            os << "- trace: " << head - first - kCapacity << " records lost\n";
+            first = head - kCapacity;
+        }
+        for (std::uint64_t index = first; index < head; ++index) {
+            TraceEntry const &entry = sEntries[index % kCapacity];
+            std::uint64_t const seq = entry.mSeq.load(std::memory_order_acquire);
+            char const *what = entry.mWhat.load(std::memory_order_acquire);
+            char const *detail = entry.mDetail.load(std::memory_order_acquire);
+            if (seq != 2 * index + 2 || entry.mSeq.load(std::memory_order_relaxed) != seq) {
+                os << "- trace: record " << index << " skipped, it is being written\n";
+                continue;
+            }
+            os << what;
+            if (detail)
+                os << " [" << detail << "]";
+            os << '\n';
+        }
+        sTail = head;
+    }
+
+private:
+    static inline std::array<TraceEntry, kCapacity> sEntries;
+    static inline std::atomic<std::uint64_t> sHead{0};
+    static inline std::uint64_t sTail = 0;
+};
+
+#ifdef NDEBUG
+using DefaultTrace = NoTrace;
+#else
+using DefaultTrace = RingTrace;
+#endif
+
+#endif